@@ -0,0 +1,178 @@
+/*
+    Copyright (C) 2012 EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*  Example : shmproducer.c
+ *
+ * This program publishes moving color bars in a shared memory ring that
+ * can be displayed by dtk_load_video_shm().
+ * This shows how to:
+ *	- create and initialize the ring
+ *	- publish the frames following the protocol of <dtk_shmvideo.h>
+ *	- timestamp the frames on the clock of dtk_gettime()
+ *
+ * Usage: shmproducer name [width height fps]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <dtk_time.h>
+#include <dtk_shmvideo.h>
+
+#define NSLOTS	3
+#define NBARS	8
+
+static volatile sig_atomic_t stop = 0;
+
+static void stop_handler(int signum)
+{
+	(void)signum;
+	stop = 1;
+}
+
+
+static struct dtk_shmv_header* create_ring(const char* name,
+                                           unsigned int w, unsigned int h,
+                                           size_t* size)
+{
+	struct dtk_shmv_header* hdr;
+	uint64_t dataoffset, stride;
+	int fd;
+
+	stride = dtk_shmv_framesize(DTK_SHMV_RGB, w, h);
+	dataoffset = DTK_SHMV_ROUNDUP(sizeof(*hdr)
+	                              + NSLOTS*sizeof(hdr->slots[0]), 64);
+	*size = dataoffset + NSLOTS*stride;
+
+	fd = shm_open(name, O_RDWR|O_CREAT|O_TRUNC, 0600);
+	if (fd < 0 || ftruncate(fd, *size)) {
+		perror("Cannot create the shared memory object");
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	hdr = mmap(NULL, *size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("Cannot map the shared memory object");
+		return NULL;
+	}
+
+	memset(hdr, 0, dataoffset);
+	hdr->format = DTK_SHMV_RGB;
+	hdr->width = w;
+	hdr->height = h;
+	hdr->nslots = NSLOTS;
+	hdr->slotstride = stride;
+	hdr->dataoffset = dataoffset;
+	hdr->head = 0;
+	sem_init(&hdr->newframe, 1, 0);
+	hdr->version = DTK_SHMV_VERSION;
+
+	// The magic number is written last: the ring is now valid
+	__atomic_store_n(&hdr->magic, DTK_SHMV_MAGIC, __ATOMIC_RELEASE);
+	return hdr;
+}
+
+
+/* Draw vertical bars shifted by n pixels */
+static void draw_bars(unsigned char* data, unsigned int w, unsigned int h,
+                      uint64_t n)
+{
+	static const unsigned char colors[NBARS][3] = {
+		{255, 255, 255}, {255, 255, 0}, {0, 255, 255}, {0, 255, 0},
+		{255, 0, 255}, {255, 0, 0}, {0, 0, 255}, {0, 0, 0}
+	};
+	unsigned int x, y, stride = DTK_SHMV_ROUNDUP(3*w, 4);
+	const unsigned char* c;
+
+	for (x=0; x<w; x++) {
+		c = colors[((x + n) % w) * NBARS / w];
+		memcpy(data + 3*x, c, 3);
+	}
+	for (y=1; y<h; y++)
+		memcpy(data + y*stride, data, 3*w);
+}
+
+
+static void publish_frame(struct dtk_shmv_header* hdr, uint64_t n)
+{
+	struct dtk_shmv_slot* sl = hdr->slots + (n % hdr->nslots);
+	unsigned char* data = (unsigned char*)hdr + hdr->dataoffset
+	                      + (n % hdr->nslots)*hdr->slotstride;
+	struct dtk_timespec ts;
+
+	// Mark the slot as being written
+	__atomic_store_n(&sl->seq, 2*n+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	draw_bars(data, hdr->width, hdr->height, n);
+	dtk_gettime(&ts);
+	__atomic_store_n(&sl->pts, (int64_t)ts.sec*1000000000 + ts.nsec,
+	                 __ATOMIC_RELAXED);
+
+	// Publish it and wake up the reader
+	__atomic_store_n(&sl->seq, 2*n+2, __ATOMIC_RELEASE);
+	__atomic_store_n(&hdr->head, n+1, __ATOMIC_RELEASE);
+	sem_post(&hdr->newframe);
+}
+
+
+int main(int argc, char* argv[])
+{
+	struct dtk_shmv_header* hdr;
+	struct dtk_timespec next;
+	unsigned int w = 640, h = 480, fps = 60;
+	size_t size;
+	uint64_t n;
+
+	if (argc != 2 && argc != 5) {
+		fprintf(stderr, "Usage: %s name [width height fps]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (argc == 5) {
+		w = atoi(argv[2]);
+		h = atoi(argv[3]);
+		fps = atoi(argv[4]);
+		if (!w || !h || !fps) {
+			fprintf(stderr, "Invalid frame size or rate\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!(hdr = create_ring(argv[1], w, h, &size)))
+		return EXIT_FAILURE;
+
+	signal(SIGINT, stop_handler);
+	signal(SIGTERM, stop_handler);
+
+	// Publish the frames at a fixed rate
+	dtk_gettime(&next);
+	for (n=0; !stop; n++) {
+		publish_frame(hdr, n);
+		dtk_addtime(&next, 0, 1000000000 / fps);
+		dtk_nanosleep(1, &next, NULL);
+	}
+
+	sem_destroy(&hdr->newframe);
+	munmap(hdr, size);
+	shm_unlink(argv[1]);
+	return EXIT_SUCCESS;
+}
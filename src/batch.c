@@ -0,0 +1,533 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL_opengl.h>
+#include <stdlib.h>
+#include <string.h>
+#include "drawtk.h"
+#include "shapes.h"
+#include "batch.h"
+#include "texmanager.h"
+
+
+/*************************************************************************
+ *                                                                       *
+ *                      Primitive conversion functions                   *
+ *                                                                       *
+ *************************************************************************/
+/* Returns the primitive type into which prim is converted when added to a
+ * batch (0 if the primitive type cannot be batched)
+ */
+static
+GLenum batch_mode(GLenum prim)
+{
+	switch (prim) {
+	case GL_TRIANGLES:
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+		return GL_TRIANGLES;
+
+	case GL_LINES:
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		return GL_LINES;
+	}
+	return 0;
+}
+
+
+/* Returns the number of indices needed to express n indices of type prim
+ * into a list of independent triangles or lines
+ */
+static
+unsigned int batch_num_indices(GLenum prim, unsigned int n)
+{
+	switch (prim) {
+	case GL_TRIANGLES:
+		return n - n%3;
+
+	case GL_LINES:
+		return n - n%2;
+
+	case GL_TRIANGLE_STRIP:
+	case GL_TRIANGLE_FAN:
+		return (n < 3) ? 0 : 3*(n-2);
+
+	case GL_LINE_STRIP:
+		return (n < 2) ? 0 : 2*(n-1);
+
+	case GL_LINE_LOOP:
+		return (n < 2) ? 0 : 2*n;
+	}
+	return 0;
+}
+
+
+/* Write in out the indices of independent triangles or lines equivalent to
+ * the n indices in of primitive type prim. base is added to each index.
+ */
+static
+void convert_indices(GLenum prim, const GLuint* in, unsigned int n,
+                     GLuint base, GLuint* out)
+{
+	unsigned int i, odd;
+
+	switch (prim) {
+	case GL_TRIANGLES:
+	case GL_LINES:
+		n = batch_num_indices(prim, n);
+		for (i=0; i<n; i++)
+			out[i] = in[i] + base;
+		break;
+
+	case GL_TRIANGLE_STRIP:
+		// Keep the winding of the odd triangles
+		for (i=0; i+2<n; i++) {
+			odd = i % 2;
+			*out++ = in[i+odd] + base;
+			*out++ = in[i+1-odd] + base;
+			*out++ = in[i+2] + base;
+		}
+		break;
+
+	case GL_TRIANGLE_FAN:
+		for (i=1; i+1<n; i++) {
+			*out++ = in[0] + base;
+			*out++ = in[i] + base;
+			*out++ = in[i+1] + base;
+		}
+		break;
+
+	case GL_LINE_STRIP:
+	case GL_LINE_LOOP:
+		for (i=0; i+1<n; i++) {
+			*out++ = in[i] + base;
+			*out++ = in[i+1] + base;
+		}
+		if (prim == GL_LINE_LOOP && n >= 2) {
+			*out++ = in[n-1] + base;
+			*out++ = in[0] + base;
+		}
+		break;
+	}
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Batch internals                              *
+ *                                                                       *
+ *************************************************************************/
+static
+struct batch_group* get_batch_group(struct dtk_batch* batch,
+                                    struct dtk_texture* tex, GLenum mode)
+{
+	unsigned int i, max;
+	struct batch_group* grp;
+
+	if (batch->ordered) {
+		// Only the last group filled can be extended
+		if (batch->cur) {
+			grp = batch->groups + batch->cur - 1;
+			if (grp->tex == tex && grp->mode == mode)
+				return grp;
+		}
+
+		// Reuse the buffers of the next group emptied by clear_batch
+		if (batch->cur < batch->num) {
+			grp = batch->groups + batch->cur++;
+			if (tex && !grp->texcoords)
+				grp->max_vert = 0;
+			grp->tex = tex;
+			grp->mode = mode;
+			grp->dirty = true;
+			return grp;
+		}
+	} else {
+		for (i=0; i<batch->num; i++) {
+			grp = batch->groups + i;
+			if (grp->tex == tex && grp->mode == mode)
+				return grp;
+		}
+	}
+
+	// Create a new group
+	if (batch->num == batch->max) {
+		max = batch->max ? 2*batch->max : 4;
+		grp = realloc(batch->groups, max*sizeof(*grp));
+		if (!grp)
+			return NULL;
+		batch->groups = grp;
+		batch->max = max;
+	}
+
+	grp = batch->groups + batch->num++;
+	batch->cur = batch->num;
+	memset(grp, 0, sizeof(*grp));
+	grp->tex = tex;
+	grp->mode = mode;
+	return grp;
+}
+
+
+static
+int reserve_batch_group(struct batch_group* grp,
+                        unsigned int nvert, unsigned int nind)
+{
+	unsigned int max;
+	void *vert, *col, *tc, *ind;
+
+	nvert += grp->num_vert;
+	nind += grp->num_ind;
+
+	if (nvert > grp->max_vert) {
+		max = grp->max_vert ? grp->max_vert : 64;
+		while (max < nvert)
+			max *= 2;
+
+		vert = realloc(grp->vertices, 2*max*sizeof(GLfloat));
+		if (vert)
+			grp->vertices = vert;
+		col = realloc(grp->colors, 4*max*sizeof(GLfloat));
+		if (col)
+			grp->colors = col;
+		tc = NULL;
+		if (grp->tex) {
+			tc = realloc(grp->texcoords, 2*max*sizeof(GLfloat));
+			if (tc)
+				grp->texcoords = tc;
+		}
+		if (!vert || !col || (grp->tex && !tc))
+			return -1;
+		grp->max_vert = max;
+	}
+
+	if (nind > grp->max_ind) {
+		max = grp->max_ind ? grp->max_ind : 64;
+		while (max < nind)
+			max *= 2;
+
+		ind = realloc(grp->indices, max*sizeof(GLuint));
+		if (!ind)
+			return -1;
+		grp->indices = ind;
+		grp->max_ind = max;
+	}
+
+	return 0;
+}
+
+
+/* Append the vertices of a single shape transformed by xform. If color is
+ * not NULL, the vertex colors are modulated by it.
+ */
+LOCAL_FN
+int batch_add_leaf(struct dtk_batch* batch, struct single_shape* sinshp,
+                   const float* xform, const float* color)
+{
+	struct batch_group* grp;
+	unsigned int i, nvert, nind, base;
+	const GLfloat* vin = sinshp->vertices;
+	GLfloat *vout, *cout, *tcout;
+	GLenum mode;
+
+	if (!(mode = batch_mode(sinshp->primtype)))
+		return -1;
+
+	nvert = sinshp->num_vert;
+	nind = batch_num_indices(sinshp->primtype, sinshp->num_ind);
+	if (!nind || !vin || !sinshp->indices)
+		return 0;
+
+	grp = get_batch_group(batch, sinshp->tex, mode);
+	if (!grp || reserve_batch_group(grp, nvert, nind))
+		return -1;
+
+	base = grp->num_vert;
+	vout = grp->vertices + 2*base;
+	cout = grp->colors + 4*base;
+	tcout = grp->tex ? grp->texcoords + 2*base : NULL;
+
+	// Transform the vertices on the CPU
+	for (i=0; i<nvert; i++) {
+		vout[2*i] = xform[0]*vin[2*i] + xform[2]*vin[2*i+1] + xform[4];
+		vout[2*i+1] = xform[1]*vin[2*i] + xform[3]*vin[2*i+1] + xform[5];
+	}
+
+	if (sinshp->colors)
+		memcpy(cout, sinshp->colors, 4*nvert*sizeof(*cout));
+	else
+		for (i=0; i<4*nvert; i++)
+			cout[i] = 1.0f;
+	if (color)
+		for (i=0; i<4*nvert; i++)
+			cout[i] *= color[i%4];
+
+	if (tcout) {
+		if (sinshp->texcoords)
+			memcpy(tcout, sinshp->texcoords,
+			       2*nvert*sizeof(*tcout));
+		else
+			memset(tcout, 0, 2*nvert*sizeof(*tcout));
+	}
+
+	convert_indices(sinshp->primtype, sinshp->indices, sinshp->num_ind,
+	                base, grp->indices + grp->num_ind);
+	grp->num_vert += nvert;
+	grp->num_ind += nind;
+	grp->dirty = true;
+
+	return 0;
+}
+
+
+static
+int add_leaf_to_batch(struct single_shape* sinshp,
+                      const float* xform, void* data)
+{
+	return batch_add_leaf(data, sinshp, xform, NULL);
+}
+
+
+LOCAL_FN
+void init_batch(struct dtk_batch* batch)
+{
+	batch->groups = NULL;
+	batch->num = batch->max = batch->cur = 0;
+	batch->ordered = false;
+}
+
+
+LOCAL_FN
+void clear_batch(struct dtk_batch* batch)
+{
+	unsigned int i;
+
+	// Keep the buffers allocated so that the batch can be refilled
+	batch->cur = 0;
+	for (i=0; i<batch->num; i++) {
+		batch->groups[i].num_vert = batch->groups[i].num_ind = 0;
+		batch->groups[i].dirty = true;
+	}
+}
+
+
+LOCAL_FN
+void free_batch(struct dtk_batch* batch)
+{
+	unsigned int i;
+	struct batch_group* grp;
+	bool ordered = batch->ordered;
+
+	for (i=0; i<batch->num; i++) {
+		grp = batch->groups + i;
+		free(grp->vertices);
+		free(grp->colors);
+		free(grp->texcoords);
+		free(grp->indices);
+		if (grp->vbo[0])
+			glDeleteBuffers(2, grp->vbo);
+	}
+	free(batch->groups);
+	init_batch(batch);
+	batch->ordered = ordered;
+}
+
+
+/* Append the geometry of shp to the batch. The vertices are transformed
+ * by the shape position and rotation, combined with xform if not NULL.
+ * In case of failure, the batch is left as it was before the call.
+ */
+LOCAL_FN
+int batch_add_shape(struct dtk_batch* batch, const struct dtk_shape* shp,
+                    const float* xform)
+{
+	unsigned int i, num = batch->num, cur = batch->cur;
+	unsigned int *count;
+	int ret;
+
+	// Save the group sizes to rollback in case of failure
+	count = malloc((2*num+1)*sizeof(*count));
+	if (!count)
+		return -1;
+	for (i=0; i<num; i++) {
+		count[2*i] = batch->groups[i].num_vert;
+		count[2*i+1] = batch->groups[i].num_ind;
+	}
+
+	ret = foreach_leaf_shape(shp, xform, add_leaf_to_batch, batch);
+	if (ret) {
+		for (i=0; i<num; i++) {
+			batch->groups[i].num_vert = count[2*i];
+			batch->groups[i].num_ind = count[2*i+1];
+		}
+		for (i=num; i<batch->num; i++)
+			batch->groups[i].num_vert = batch->groups[i].num_ind = 0;
+		for (i=0; i<batch->num; i++)
+			batch->groups[i].dirty = true;
+		batch->cur = cur;
+	}
+
+	free(count);
+	return ret;
+}
+
+
+/* Upload the group data into its buffer objects if it has been modified
+ * since the last upload and bind them. Returns 0 if the buffer objects are
+ * bound, -1 otherwise
+ */
+static
+int upload_batch_group(struct batch_group* grp)
+{
+	GLsizeiptr vsize = 2*grp->num_vert*sizeof(GLfloat);
+
+	if (!grp->vbo[0]) {
+		glGenBuffers(2, grp->vbo);
+		if (!grp->vbo[0])
+			return -1;
+		grp->dirty = true;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, grp->vbo[0]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, grp->vbo[1]);
+	if (!grp->dirty)
+		return 0;
+
+	glBufferData(GL_ARRAY_BUFFER, (grp->tex ? 4 : 3)*vsize,
+	             NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, vsize, grp->vertices);
+	glBufferSubData(GL_ARRAY_BUFFER, vsize, 2*vsize, grp->colors);
+	if (grp->tex)
+		glBufferSubData(GL_ARRAY_BUFFER, 3*vsize,
+		                vsize, grp->texcoords);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, grp->num_ind*sizeof(GLuint),
+	             grp->indices, GL_STATIC_DRAW);
+
+	grp->dirty = false;
+	return 0;
+}
+
+
+LOCAL_FN
+void draw_batch(struct dtk_batch* batch)
+{
+	unsigned int i;
+	struct batch_group* grp;
+	const GLvoid *vert, *col, *tc, *ind;
+	bool usevbo;
+
+	for (i=0; i<batch->num; i++) {
+		grp = batch->groups + i;
+		if (!grp->num_ind || !texture_drawable(grp->tex))
+			continue;
+
+		usevbo = !upload_batch_group(grp);
+		if (usevbo) {
+			vert = (const GLvoid*)0;
+			col = (const GLvoid*)(2*grp->num_vert*sizeof(GLfloat));
+			tc = (const GLvoid*)(6*grp->num_vert*sizeof(GLfloat));
+			ind = (const GLvoid*)0;
+		} else {
+			vert = grp->vertices;
+			col = grp->colors;
+			tc = grp->texcoords;
+			ind = grp->indices;
+		}
+
+		glVertexPointer(2, GL_FLOAT, 0, vert);
+		glColorPointer(4, GL_FLOAT, 0, col);
+
+		bind_texture(grp->tex);
+		if (grp->tex) {
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+			glTexCoordPointer(2, GL_FLOAT, 0, tc);
+		}
+
+		glDrawElements(grp->mode, grp->num_ind, GL_UNSIGNED_INT, ind);
+
+		if (grp->tex)
+			glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+		unbind_texture(grp->tex);
+
+		if (usevbo) {
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+		}
+	}
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                         Batch API functions                           *
+ *                                                                       *
+ *************************************************************************/
+API_EXPORTED
+dtk_hbatch dtk_create_batch(void)
+{
+	struct dtk_batch* batch;
+
+	batch = malloc(sizeof(*batch));
+	if (batch)
+		init_batch(batch);
+
+	return batch;
+}
+
+
+API_EXPORTED
+int dtk_batch_add(dtk_hbatch batch, const dtk_hshape shp)
+{
+	if (!batch || !shp)
+		return -1;
+
+	return batch_add_shape(batch, shp, NULL);
+}
+
+
+API_EXPORTED
+void dtk_batch_clear(dtk_hbatch batch)
+{
+	if (batch)
+		clear_batch(batch);
+}
+
+
+API_EXPORTED
+void dtk_batch_draw(dtk_hbatch batch)
+{
+	if (batch)
+		draw_batch(batch);
+}
+
+
+API_EXPORTED
+void dtk_destroy_batch(dtk_hbatch batch)
+{
+	if (!batch)
+		return;
+
+	free_batch(batch);
+	free(batch);
+}
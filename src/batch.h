@@ -0,0 +1,68 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <GL/gl.h>
+#include <stdbool.h>
+
+struct dtk_shape;
+struct single_shape;
+struct dtk_texture;
+
+// Geometry sharing the same texture and primitive type
+struct batch_group
+{
+	struct dtk_texture* tex;
+	GLenum mode;
+	GLfloat* vertices;
+	GLfloat* colors;
+	GLfloat* texcoords;
+	GLuint* indices;
+	unsigned int num_vert, num_ind;
+	unsigned int max_vert, max_ind;
+
+	// Buffer objects holding the group data
+	GLuint vbo[2];
+	bool dirty;
+};
+
+struct dtk_batch
+{
+	struct batch_group* groups;
+	unsigned int num, max;
+
+	// If ordered, only consecutive leaves are merged so that the drawing
+	// order is kept. cur is then the number of groups filled.
+	bool ordered;
+	unsigned int cur;
+};
+
+LOCAL_FN void init_batch(struct dtk_batch* batch);
+LOCAL_FN void clear_batch(struct dtk_batch* batch);
+LOCAL_FN void free_batch(struct dtk_batch* batch);
+LOCAL_FN int batch_add_shape(struct dtk_batch* batch,
+                             const struct dtk_shape* shp,
+                             const float* xform);
+LOCAL_FN int batch_add_leaf(struct dtk_batch* batch,
+                            struct single_shape* sinshp,
+                            const float* xform, const float* color);
+LOCAL_FN void draw_batch(struct dtk_batch* batch);
+
+#endif // BATCH_H
@@ -24,6 +24,7 @@
 #include <math.h>
 #include <float.h>
 #include <string.h>
+#include <stdlib.h>
 #include "drawtk.h"
 #include "shapes.h"
 #include "fonttex.h"
@@ -41,6 +42,24 @@ static GLenum primitive_mode[] = {
 };
 #define NUM_PRIM_MODE (sizeof(primitive_mode)/sizeof(primitive_mode[0]))
 
+/* String shape whose buffers can hold capacity characters. The glyphs
+ * and pen positions of the displayed text are kept to rewrite only the
+ * characters that change. newcodes receives the next text.
+ */
+struct text_shape
+{
+	// Must be first: the shape is drawn as a single shape
+	struct single_shape sinshp;
+
+	struct dtk_font* font;
+	float size, x, y, orgx, orgy;
+	unsigned int alignment, capacity, len;
+
+	struct character* chars;
+	float* pens;
+	uint32_t *codes, *newcodes;
+};
+
 static void get_bbox(struct single_shape* sinshp, float* left, float *right, 
                                              float* top, float* bottom)
 {
@@ -353,6 +372,29 @@ dtk_hshape dtk_create_image(struct dtk_shape* shp, float x, float y, float width
 }
 
 
+/* Get the point of the bounding box of a text put at the position of the
+ * shape according to alignment
+ */
+static
+void get_text_origin(unsigned int alignment, float l, float r, float t,
+                     float b, float* orgx, float* orgy)
+{
+	if (alignment & DTK_HMID)
+		*orgx = (l+r)/2.0f;
+	else if (alignment & DTK_RIGHT)
+		*orgx = r;
+	else
+		*orgx = l;
+
+	if (alignment & DTK_VMID)
+		*orgy = (t+b)/2.0f;
+	else if (alignment & DTK_TOP)
+		*orgy = t;
+	else
+		*orgy = b;
+}
+
+
 API_EXPORTED
 dtk_hshape dtk_create_string(struct dtk_shape* shp, const char* text,
 			     float size, float x, float y,
@@ -363,13 +405,26 @@ dtk_hshape dtk_create_string(struct dtk_shape* shp, const char* text,
 	GLuint* ind;
 	float pos = 0.0f;
 	float l,r,t,b,orgx, orgy;
-	unsigned int i, len = text ? strlen(text) : 0;
+	unsigned int i, len = text ? utf8_decode(text, NULL) : 0;
+	struct character* chars;
+	uint32_t* codes;
+
+	// Get the glyphs of the UTF-8 text, rendering the new ones
+	chars = malloc(len*(sizeof(*chars) + sizeof(*codes)) + 1);
+	if (!chars)
+		return NULL;
+	codes = (uint32_t*)(chars + len);
+	if (len)
+		utf8_decode(text, codes);
+	get_font_glyphs(font, codes, len, chars);
 
 	shp = create_generic_shape(shp, 4*len, NULL, NULL, color, 
 	                               6*len, NULL, GL_TRIANGLES,
 				       font->tex, DTKF_ALLOC|DTKF_UNICOLOR);
-	if (!shp)
+	if (!shp) {
+		free(chars);
 		return NULL;
+	}
 	
 	ind = ((struct single_shape*)(shp->data))->indices;
 	vert = ((struct single_shape*)(shp->data))->vertices;
@@ -377,24 +432,12 @@ dtk_hshape dtk_create_string(struct dtk_shape* shp, const char* text,
 
 	// setup letter vertices
 	for (i=0; i<len; i++)
-		dtk_char_pos(font, text[i], vert+8*i, tc+8*i, 
+		dtk_char_pos(chars+i, vert+8*i, tc+8*i, 
 		             ind+6*i, 4*i, &pos);
+	free(chars);
 
 	get_bbox(shp->data, &l, &r, &t, &b);
-
-	if (alignment & DTK_HMID)
-		orgx = (l+r)/2.0f;
-	else if (alignment & DTK_RIGHT)
-		orgx = r;
-	else
-		orgx = l;
-
-	if (alignment & DTK_VMID)
-		orgy = (t+b)/2.0f;
-	else if (alignment & DTK_TOP)
-		orgy = t;
-	else
-		orgy = b;
+	get_text_origin(alignment, l, r, t, b, &orgx, &orgy);
 
 	for (i=0; i<8*len; i+=2) {
 		vert[i  ] = (vert[i  ] - orgx)*size + x;	
@@ -404,6 +447,218 @@ dtk_hshape dtk_create_string(struct dtk_shape* shp, const char* text,
 	return shp;
 }
 
+
+/**************************************************************************
+ *                          Updatable strings                             *
+ **************************************************************************/
+static
+void destroy_text_shape(void* data)
+{
+	struct text_shape* txt = data;
+
+	if (!txt)
+		return;
+
+	free_single_shape_buffers(&txt->sinshp);
+	free(txt->chars);
+	free(txt);
+}
+
+
+static
+struct text_shape* alloc_text_shape(unsigned int capacity)
+{
+	struct text_shape* txt;
+	struct single_shape* sinshp;
+	unsigned int nvert = 4*capacity;
+
+	if (!(txt = calloc(1, sizeof(*txt))))
+		return NULL;
+	sinshp = &txt->sinshp;
+
+	// Same layout as the buffers of the other single shapes. The unused
+	// vertices are zeroed.
+	sinshp->vertices = calloc(8*nvert, sizeof(*sinshp->vertices));
+	sinshp->indices = malloc(6*capacity*sizeof(*sinshp->indices));
+	txt->chars = malloc(capacity*(sizeof(*txt->chars)
+	                              + sizeof(*txt->pens)
+	                              + 2*sizeof(*txt->codes)));
+	if (!sinshp->vertices || !sinshp->indices || !txt->chars) {
+		free(sinshp->vertices);
+		free(sinshp->indices);
+		free(txt->chars);
+		free(txt);
+		return NULL;
+	}
+	sinshp->colors = sinshp->vertices + 2*nvert;
+	sinshp->texcoords = sinshp->colors + 4*nvert;
+	sinshp->num_vert = nvert;
+	sinshp->isalloc = 1;
+	txt->pens = (float*)(txt->chars + capacity);
+	txt->codes = (uint32_t*)(txt->pens + capacity);
+	txt->newcodes = txt->codes + capacity;
+	txt->capacity = capacity;
+
+	return txt;
+}
+
+
+/* Write the vertices of the i-th character at the pen position pen
+ */
+static
+void set_text_char(struct text_shape* txt, unsigned int i, float pen)
+{
+	struct single_shape* sinshp = &txt->sinshp;
+	float* vert = sinshp->vertices + 8*i;
+	unsigned int k;
+
+	dtk_char_pos(txt->chars + i, vert, sinshp->texcoords + 8*i,
+	             sinshp->indices + 6*i, 4*i, &pen);
+
+	for (k=0; k<8; k+=2) {
+		vert[k  ] = (vert[k  ] - txt->orgx)*txt->size + txt->x;
+		vert[k+1] = (vert[k+1] - txt->orgy)*txt->size + txt->y;
+	}
+}
+
+
+/* Display text, rewriting only the characters whose glyph or position
+ * have changed. The alignment is computed from the glyphs kept from the
+ * previous texts. No memory is allocated unless new glyphs must be added
+ * to the font. Returns 1 if the shape has been modified, 0 if not and -1
+ * if the text is longer than the capacity.
+ */
+static
+int set_text(struct text_shape* txt, const char* text)
+{
+	const struct character* ch;
+	unsigned int i, j, n = text ? utf8_decode(text, NULL) : 0;
+	float l, r, t, b, orgx, orgy, pen;
+	uint32_t* codes = txt->newcodes;
+	bool realign, modified = (n != txt->len);
+
+	if (n > txt->capacity)
+		return -1;
+	if (n)
+		utf8_decode(text, codes);
+
+	// Get the glyphs of the runs of new codepoints
+	for (i=0; i<n; i=j) {
+		for (j=i; j<n && (j >= txt->len || codes[j] != txt->codes[j]);)
+			j++;
+		if (j > i)
+			get_font_glyphs(txt->font, codes+i, j-i, txt->chars+i);
+		else
+			j++;
+	}
+
+	// Bounding box of the quads of the characters
+	l = b = FLT_MAX;
+	r = t = -FLT_MAX;
+	for (i=0, pen=0.0f; i<n; i++) {
+		ch = txt->chars + i;
+		l = MIN(l, ch->xmin + pen);
+		r = MAX(r, ch->xmax + pen);
+		b = MIN(b, ch->ymin);
+		t = MAX(t, ch->ymax);
+		pen += ch->advance;
+	}
+	get_text_origin(txt->alignment, l, r, t, b, &orgx, &orgy);
+	realign = (orgx != txt->orgx || orgy != txt->orgy);
+	txt->orgx = orgx;
+	txt->orgy = orgy;
+
+	for (i=0, pen=0.0f; i<n; i++) {
+		if (realign || i >= txt->len || codes[i] != txt->codes[i]
+		   || pen != txt->pens[i]) {
+			set_text_char(txt, i, pen);
+			txt->pens[i] = pen;
+			modified = true;
+		}
+		pen += txt->chars[i].advance;
+	}
+
+	txt->newcodes = txt->codes;
+	txt->codes = codes;
+	txt->len = n;
+	txt->sinshp.num_ind = 6*n;
+	if (modified)
+		txt->sinshp.dirty = true;
+
+	return modified ? 1 : 0;
+}
+
+
+API_EXPORTED
+dtk_hshape dtk_create_dynamic_string(dtk_hshape shp, unsigned int capacity,
+                                     const char* text, float size,
+                                     float x, float y,
+                                     unsigned int alignment,
+                                     const float* color, dtk_hfont font)
+{
+	struct text_shape* txt;
+	struct single_shape* sinshp;
+	unsigned int i, is_shp_alloc = 0;
+
+	if (!capacity || !(txt = alloc_text_shape(capacity)))
+		return NULL;
+
+	sinshp = &txt->sinshp;
+	for (i=0; i<4*sinshp->num_vert; i+=4)
+		memcpy(sinshp->colors+i, color, 4*sizeof(*color));
+	sinshp->primtype = GL_TRIANGLES;
+	sinshp->tex = font->tex;
+	sinshp->usage = DTK_DYNAMIC_DRAW;
+	sinshp->dirty = true;
+	txt->font = font;
+	txt->size = size;
+	txt->x = x;
+	txt->y = y;
+	txt->alignment = alignment;
+
+	if (set_text(txt, text) < 0) {
+		destroy_text_shape(txt);
+		return NULL;
+	}
+
+	if (!shp) {
+		if (!(shp = calloc(1, sizeof(*shp)))) {
+			destroy_text_shape(txt);
+			return NULL;
+		}
+		is_shp_alloc = 1;
+	}
+
+	if (!is_shp_alloc)
+		shp->destroyproc(shp->data);
+	shp->data = txt;
+	set_single_shape_procs(shp, destroy_text_shape);
+	shp->stamp++;
+
+	return shp;
+}
+
+
+API_EXPORTED
+int dtk_update_string(dtk_hshape shp, const char* text)
+{
+	int ret;
+
+	if (!shp || shp->destroyproc != destroy_text_shape)
+		return -1;
+
+	ret = set_text(shp->data, text);
+	if (ret < 0)
+		return -1;
+
+	// Notify the composite shapes containing it
+	if (ret)
+		shp->stamp++;
+
+	return 0;
+}
+
+
 API_EXPORTED
 dtk_hshape dtk_create_complex_shape(dtk_hshape shp,
                  unsigned int nvert, const float* vertpos,
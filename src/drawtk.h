@@ -19,6 +19,8 @@
 #ifndef FEEDBACK_H
 #define FEEDBACK_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif 
@@ -38,12 +40,44 @@ typedef struct dtk_texture* dtk_htex;
 dtk_htex dtk_load_image(const char* filename, unsigned int mipmap_maxlevel);
 void dtk_destroy_texture(dtk_htex tex);
 void dtk_texture_getsize(dtk_htex, unsigned int* w, unsigned int* h);
+dtk_htex dtk_load_image_async(const char* filename, unsigned int mipmap_maxlevel);
+#define DTKT_LOADING	0x01
+#define DTKT_LOADED	0x02
+#define DTKT_FAILED	0x04
+#define DTKT_RESIDENT	0x08
+int dtk_texture_getstate(dtk_htex tex);
+int dtk_texture_wait(dtk_htex tex);
+void dtk_set_upload_budget(unsigned int bytes);
+#define DTK_MIPMAP_BOX		0
+#define DTK_MIPMAP_BICUBIC	1
+#define DTK_MIPMAP_GL		2
+int dtk_set_mipmap_mode(unsigned int mode);
+struct dtk_texture_stats {
+	size_t gpu_bytes;
+	size_t cpu_bytes;
+	unsigned int num_textures;
+	unsigned int num_resident;
+	unsigned long evictions;
+	unsigned long reloads;
+	unsigned long reload_failures;
+};
+void dtk_set_texture_budget(size_t bytes);
+void dtk_texture_getstats(struct dtk_texture_stats* stats);
 
 /* Font functions */
 typedef struct dtk_font* dtk_hfont;
+#define DTK_FONT_SDF	0x01
 dtk_hfont dtk_load_font(const char* fontname);
+dtk_hfont dtk_load_font_ex(const char* fontname, unsigned int flags);
 void dtk_destroy_font(dtk_hfont font);
 
+struct dtk_font_cachestats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long writes;
+};
+void dtk_font_getcachestats(struct dtk_font_cachestats* stats);
+
 
 /* Handle to shape structure */
 typedef struct dtk_shape* dtk_hshape;
@@ -81,6 +115,12 @@ dtk_hshape dtk_create_string(struct dtk_shape* shp, const char* text,
 			     float size, float x, float y, 
 			     unsigned int alignment,
 			     const float* color, dtk_hfont font);
+dtk_hshape dtk_create_dynamic_string(dtk_hshape shp, unsigned int capacity,
+                                     const char* text, float size,
+                                     float x, float y,
+                                     unsigned int alignment,
+                                     const float* color, dtk_hfont font);
+int dtk_update_string(dtk_hshape shp, const char* text);
 dtk_hshape dtk_create_composite_shape(dtk_hshape shp, unsigned int num_shp, 
                                 const dtk_hshape* array, int free_children);
 dtk_hshape dtk_create_complex_shape(dtk_hshape shp,
@@ -99,9 +139,33 @@ void dtk_setcolor_shape(dtk_hshape shp, const float* color, unsigned int mask);
 /* Draw a shape */
 void dtk_draw_shape(const dtk_hshape shp);
 
+/* Usage hint of the shape data */
+#define DTK_STATIC_DRAW		0
+#define DTK_DYNAMIC_DRAW	1
+#define DTK_STREAM_DRAW		2
+int dtk_set_shape_usage(dtk_hshape shp, unsigned int usage);
+int dtk_freeze_shape(dtk_hshape shp, int freeze);
+
 /* Destroy shape */
 void dtk_destroy_shape(dtk_hshape shp);
 
+/* Batch functions */
+typedef struct dtk_batch* dtk_hbatch;
+dtk_hbatch dtk_create_batch(void);
+int dtk_batch_add(dtk_hbatch batch, const dtk_hshape shp);
+void dtk_batch_clear(dtk_hbatch batch);
+void dtk_batch_draw(dtk_hbatch batch);
+void dtk_destroy_batch(dtk_hbatch batch);
+
+/* Instances functions */
+typedef struct dtk_instances* dtk_hinstances;
+dtk_hinstances dtk_create_instances(dtk_hshape model, unsigned int num);
+int dtk_set_instances(dtk_hinstances inst, unsigned int first,
+                      unsigned int num, const float* pos,
+                      const float* rot, const float* colors);
+void dtk_draw_instances(dtk_hinstances inst);
+void dtk_destroy_instances(dtk_hinstances inst);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,101 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DTK_SHMVIDEO_H
+#define DTK_SHMVIDEO_H
+
+/* Protocol of the shared memory rings read by dtk_load_video_shm().
+ *
+ * The ring is a POSIX shared memory object created by the producer. It
+ * starts with struct dtk_shmv_header followed by its nslots slot
+ * descriptors. Frame n is written in slot n % nslots whose data starts at
+ * dataoffset + (n % nslots)*slotstride from the beginning of the object.
+ *
+ * To publish frame n, the producer sets the seq field of the slot to
+ * 2n+1, writes the frame and its timestamp, sets seq to 2n+2, sets head
+ * to n+1 and posts newframe. The fields seq and head must be accessed
+ * atomically. A frame is valid only if seq has the same even value
+ * before and after it is read.
+ */
+
+#include <stdint.h>
+#include <semaphore.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DTK_SHMV_MAGIC		0x564d4844	/* "DHMV" */
+#define DTK_SHMV_VERSION	1
+
+/* Frame formats. Rows are padded to a multiple of 4 bytes. The chroma
+ * planes of YUV frames follow the luma plane, each of them having half
+ * the (rounded up to even) width and height of the frame. */
+#define DTK_SHMV_RGB	0	/* packed 24 bits RGB */
+#define DTK_SHMV_GRAY	1	/* 8 bits luminance */
+#define DTK_SHMV_I420	2	/* planar YUV 4:2:0, U plane then V plane */
+#define DTK_SHMV_NV12	3	/* planar YUV 4:2:0, interleaved UV plane */
+
+struct dtk_shmv_slot {
+	uint64_t seq;
+	int64_t pts;	/* ns on the clock of dtk_gettime(), -1 if unknown */
+};
+
+struct dtk_shmv_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t nslots;
+	uint64_t slotstride;
+	uint64_t dataoffset;
+	uint64_t head;
+	sem_t newframe;		/* process shared */
+	struct dtk_shmv_slot slots[];
+};
+
+#define DTK_SHMV_ROUNDUP(x, a)	(((x)+(a)-1) / (a) * (a))
+
+/* Size in bytes of a frame of the given format and size */
+static inline
+uint64_t dtk_shmv_framesize(uint32_t format, uint32_t w, uint32_t h)
+{
+	uint64_t luma = (uint64_t)DTK_SHMV_ROUNDUP(w, 4)
+	                * DTK_SHMV_ROUNDUP(h, 2);
+	uint64_t cw = DTK_SHMV_ROUNDUP(w, 2) / 2;
+	uint64_t ch = DTK_SHMV_ROUNDUP(h, 2) / 2;
+
+	switch (format) {
+	case DTK_SHMV_RGB:
+		return (uint64_t)DTK_SHMV_ROUNDUP(3*w, 4) * h;
+	case DTK_SHMV_GRAY:
+		return (uint64_t)DTK_SHMV_ROUNDUP(w, 4) * h;
+	case DTK_SHMV_I420:
+		return luma + 2*DTK_SHMV_ROUNDUP(cw, 4)*ch;
+	case DTK_SHMV_NV12:
+		return luma + DTK_SHMV_ROUNDUP(w, 4)*ch;
+	default:
+		return 0;
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
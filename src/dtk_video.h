@@ -28,24 +28,71 @@ extern "C" {
 
 #define	DTKV_PLAYING	0x01
 #define DTKV_EOS	0x02
+#define DTKV_READY	0x04
+#define DTKV_ERROR	0x08
 
 
 enum dtk_video_cmd {
 	DTKV_CMD_PLAY = 0,
 	DTKV_CMD_PAUSE,
 	DTKV_CMD_SEEK,
+	DTKV_CMD_SEEK_ACCURATE,
+	DTKV_CMD_LOOP,
 };
 
 #define DTK_AUTOSTART	0x01
 #define DTK_NOBLOCKING	0x02
+#define DTK_ZEROCOPY	0x04
 
 dtk_htex dtk_load_video_tcp(int flags, const char *server, int port);
 dtk_htex dtk_load_video_udp(int flags, int port);
 dtk_htex dtk_load_video_file(int flags, const char *file);
 dtk_htex dtk_load_video_test(int flags);
 dtk_htex dtk_load_video_gst(int flags, const char* desc);
+dtk_htex dtk_load_video_shm(int flags, const char* name);
 int dtk_video_exec(dtk_htex video, int command, const void* arg);
 int dtk_video_getstate(dtk_htex video);
+long dtk_video_present(dtk_htex video, long time);
+void dtk_video_set_target_size(unsigned int width, unsigned int height);
+int dtk_video_set_playlist(dtk_htex video, unsigned int num,
+                           const char* const* files);
+
+typedef void (*dtk_video_readyfn)(dtk_htex video, int state, void* data);
+int dtk_video_set_ready_callback(dtk_htex video, dtk_video_readyfn fn,
+                                 void* data);
+
+struct dtk_video_poolstats {
+	unsigned int num_clips;
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	long warmup_ms;
+	long max_warmup_ms;
+};
+struct dtk_video_seekstats {
+	unsigned long num_seeks;
+	long last_us;
+	long mean_us;
+	long max_us;
+	int indexed;
+};
+int dtk_video_getseekstats(dtk_htex video, struct dtk_video_seekstats* st);
+
+#define DTKV_NBINS	12
+struct dtk_video_stats {
+	unsigned long decoded;
+	unsigned long dropped;
+	unsigned long uploaded;
+	unsigned long presented;
+	unsigned long decode_hist[DTKV_NBINS];
+	unsigned long upload_hist[DTKV_NBINS];
+	long latency_us;
+};
+int dtk_video_getstats(dtk_htex video, struct dtk_video_stats* stats);
+
+int dtk_video_preload(int flags, const char* file);
+void dtk_video_set_poolsize(unsigned int nclips);
+void dtk_video_getpoolstats(struct dtk_video_poolstats* stats);
 
 #ifdef __cplusplus
 }
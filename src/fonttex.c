@@ -26,20 +26,91 @@
 #include FT_OUTLINE_H
 #include FT_TRIGONOMETRY_H
 #include <fontconfig/fontconfig.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "drawtk.h"
 #include "fonttex.h"
 #include "texmanager.h"
+#include "workpool.h"
 
 #define SIZE		(64)
-#define FONT_MXLVL	0
 #define CHHEIGHT	SIZE
 #define CHWIDTH		SIZE
-#define MAPWIDTH	(16*CHHEIGHT)
-#define MAPHEIGHT	(16*CHWIDTH)
 #define MAX(arg1, arg2)	((arg1) > (arg2) ? (arg1) : (arg2))
+#define FONT_PREFIX	"FONT:"
+#define SDFFONT_PREFIX	"SDFFONT:"
 
+// Width, initial and maximal heights of the atlas. The t coordinates of
+// the glyphs refer to the maximal height.
+#define ATLAS_WIDTH	1024
+#define ATLAS_MINHEIGHT	128
+#define ATLAS_MAXHEIGHT	2048
+
+// Empty pixels around the glyphs (to prevent bleeding when filtered) and
+// rounding of the height of new shelves
+#define GLYPH_PAD	1
+#define SHELF_ROUND	4
+
+// Initial size of the glyph table (must be a power of 2)
+#define GLYPHTABLE_MINSIZE	256
+
+#define REPLACEMENT_CHAR	0xFFFD
+
+// Distance fields are rendered at a reduced size, and span SDF_SPREAD
+// pixels on each side of the outlines
+#define SDF_DOWNSCALE	2
+#define SDF_SPREAD	4
+#define EDT_INF		1e20f
+
+// New glyphs are rendered in parallel when at least RASTER_MIN of them are
+// requested at once, by jobs of at least RASTER_CHUNK glyphs
+#define RASTER_MIN	32
+#define RASTER_CHUNK	16
+
+// Atlases are cached in the drawtk directory of the user cache
+#define CACHE_DIR	"drawtk"
+#define CACHE_SUFFIX	".atlas"
+#define CACHE_MAGIC	"DTKFNT1"
+
+// The header is followed by the texture descriptor of the font, the path
+// of its file, the glyphs, the shelves and the rows of the atlas
+struct cache_header
+{
+	char magic[8];
+	uint32_t params[8];
+	uint64_t filesize;
+	int64_t mtime;
+	int32_t faceidx;
+	uint32_t ppem, unit;
+	uint32_t keylen, pathlen;
+	uint32_t nglyphs, nshelves, height;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned long hits, misses, writes;
+} cachestats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Image of a glyph to copy in the atlas: its FreeType bitmap or, for
+// distance field fonts, the field computed from it
+struct glyph_image {
+	const uint8_t* buffer;
+	int pitch;
+	unsigned int w, h;
+	int left, top;
+	uint8_t* field;
+};
 
 
 static 
@@ -69,75 +140,26 @@ void get_max_size(FT_Face face, unsigned int *h, unsigned int *w)
 }
 
 
+/* Open the font file or the font matching the description fname and
+ * record which file and face have been opened
+ */
 static
-void render_char(FT_Face face, uint8_t* bits, unsigned ic,
-                 struct dtk_font* font, unsigned int ppem, unsigned int lvl)
+int open_font_face(struct dtk_font* font, const char* fname)
 {
-	int j, imin, w, jmax, h, cm_w, ch_h, ch_w;
-	FT_Bitmap* bitmap;
-	FT_BitmapGlyph bmglyph;
-	FT_Glyph glyph;
-	FT_BBox bbox;
-	uint8_t* bmbits;
-	struct character* ch;
-	unsigned int sc = 0x01 << lvl;
-	unsigned int currppem = ppem / (float)sc ;
-	cm_w = MAPWIDTH / sc;
-	ch_w = CHWIDTH / sc;
-	ch_h = CHHEIGHT / sc;
-
-	// Convert the glyph to a bitmap.
-	FT_Set_Pixel_Sizes(face, currppem, currppem);
-	FT_Load_Glyph(face, FT_Get_Char_Index(face, ic), FT_LOAD_DEFAULT);
-	FT_Get_Glyph(face->glyph, &glyph);
-	FT_Glyph_To_Bitmap( &glyph, ft_render_mode_normal, 0, 1 );
-	bmglyph = (FT_BitmapGlyph)glyph;
-	bitmap=&(bmglyph->bitmap);
-
-	
-	FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_UNSCALED, &bbox);
-	w = bitmap->width;
-	h = bitmap->rows;
-	imin = ((ic-32)%16)* ch_w + (ch_w-w)/2;
-	jmax = h + ((ic-32)/16)*ch_h + (ch_h-h)/2;
-
-	if (lvl == 0) {
-		ch = &(font->ch[ic-32]);
-		ch->txmin = ((float)(imin))/MAPWIDTH;
-		ch->txmax = ((float)(imin+w))/MAPWIDTH;
-		ch->tymin = ((float)(jmax-h))/MAPHEIGHT;
-		ch->tymax = ((float)(jmax))/MAPHEIGHT;
-		ch->xmin = bbox.xMin/(64.0f*CHWIDTH);
-		ch->xmax = bbox.xMax/(64.0f*CHWIDTH);
-		ch->ymin = bbox.yMin/(64.0f*CHHEIGHT);
-		ch->ymax = bbox.yMax/(64.0f*CHHEIGHT);
-		ch->advance = face->glyph->advance.x/((float)ppem*64.0f);
-	}
-
-	bmbits = bitmap->buffer;
-	for (j=0; j<h; j++) 
-		memcpy(bits + imin+(jmax-j)*cm_w, bmbits + w*j, w);
-
-	FT_Done_Glyph(glyph);
-}
-
-
-static
-int load_glyph(void **bits, struct dtk_font *font, const char *fname,
-		unsigned int mxlvl)
-{
-	int i, error = 0;
-	FT_Face face;
-	FT_Library library;
-	unsigned int h, w, max_size, lvl, maxsc, ppem;
-	maxsc = (0x01 << mxlvl);
+	int error = 0;
+	struct stat st;
 
-	FT_Init_FreeType(&library);
+	if (FT_Init_FreeType(&font->library))
+		return -1;
 
 	// First test with fname as filename, otherwise
 	// as a font description
-	if (FT_New_Face(library, fname, 0, &face)) {
-		int id;
+	if (!FT_New_Face(font->library, fname, 0, &font->face)) {
+		font->faceidx = 0;
+		if (!(font->filename = strdup(fname)))
+			error = 1;
+	} else {
+		int id = 0;
 		unsigned char* fn = NULL;
 		FcPattern *pat, *match;
 		FcResult result;
@@ -149,57 +171,1164 @@ int load_glyph(void **bits, struct dtk_font *font, const char *fname,
 		match = FcFontMatch(0, pat, &result);
 		if ( !match || FcPatternGetString(match, FC_FILE, 0, &fn)
 		  || FcPatternGetInteger(match, FC_INDEX, 0, &id)
-		  || FT_New_Face(library, (char*)fn, id, &face))
+		  || FT_New_Face(font->library, (char*)fn, id, &font->face)
+		  || !(font->filename = strdup((char*)fn)))
 			error = 1;
+		font->faceidx = id;
 
 		FcPatternDestroy(pat);
 		FcPatternDestroy(match);
 	}
 
+	// Version of the file for the atlas cache
+	if (!error && !stat(font->filename, &st)) {
+		font->filesize = st.st_size;
+		font->mtime = st.st_mtime;
+	}
+
 	if (error) {
-		FT_Done_FreeType(library);
+		if (font->face)
+			FT_Done_Face(font->face);
+		FT_Done_FreeType(font->library);
+		font->face = NULL;
+		font->library = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Open a face of the font file at the size of the glyphs of the atlas
+ */
+static
+int open_face(const struct dtk_font* font, FT_Library* library,
+              FT_Face* face)
+{
+	if (FT_Init_FreeType(library))
+		return -1;
+	if (FT_New_Face(*library, font->filename, font->faceidx, face)) {
+		FT_Done_FreeType(*library);
+		*face = NULL;
+		*library = NULL;
+		return -1;
+	}
+
+	FT_Set_Pixel_Sizes(*face, font->ppem, font->ppem);
+	return 0;
+}
+
+
+/* Open the face of a font loaded from the atlas cache, when a glyph
+ * missing from the cache must be rendered
+ */
+static
+int open_glyph_face(struct dtk_font* font)
+{
+	if (font->face)
+		return 0;
+
+	return open_face(font, &font->library, &font->face);
+}
+
+
+/* Open the k-th face used by the worker threads rendering glyphs
+ */
+static
+int open_work_face(struct dtk_font* font, unsigned int k)
+{
+	if (font->wface[k])
+		return 0;
+
+	return open_face(font, &font->wlibrary[k], &font->wface[k]);
+}
+
+
+static
+void close_font(struct dtk_font* font)
+{
+	unsigned int i;
+
+	if (font->face)
+		FT_Done_Face(font->face);
+	if (font->library)
+		FT_Done_FreeType(font->library);
+	for (i=0; i<FONT_NWORKFACES; i++) {
+		if (font->wface[i])
+			FT_Done_Face(font->wface[i]);
+		if (font->wlibrary[i])
+			FT_Done_FreeType(font->wlibrary[i]);
+	}
+	free(font->glyphs);
+	free(font->shelves);
+	free(font->filename);
+	free(font->cachefile);
+}
+
+
+/* Open the font and scale its glyphs so that the largest Latin-1 glyph
+ * fits in a SIZE x SIZE square (reduced by SDF_DOWNSCALE for distance
+ * fields). The glyph table is empty.
+ */
+static
+int init_font(struct dtk_font* font, const char* fname, bool sdf)
+{
+	unsigned int h, w, max_size;
+
+	if (open_font_face(font, fname))
+		return -1;
+
+	FT_Set_Pixel_Sizes(font->face, CHWIDTH, CHHEIGHT);
+	get_max_size(font->face, &h, &w);
+	max_size = MAX(MAX(h, w), 1);
+	font->ppem = (SIZE * SIZE) / max_size;
+	font->unit = CHWIDTH;
+	font->sdf = sdf;
+	if (sdf) {
+		font->ppem = MAX(font->ppem / SDF_DOWNSCALE, 1);
+		font->unit = CHWIDTH / SDF_DOWNSCALE;
+	}
+	FT_Set_Pixel_Sizes(font->face, font->ppem, font->ppem);
+
+	font->size = GLYPHTABLE_MINSIZE;
+	font->num = 0;
+	font->shelves = NULL;
+	font->nshelves = 0;
+	if (!(font->glyphs = calloc(font->size, sizeof(*font->glyphs))))
+		return -1;
+
+	return 0;
+}
+
+
+/**************************************************************************
+ *                            Distance fields                             *
+ **************************************************************************/
+/* Squared euclidean distance transform of the n samples of f into d
+ * (Felzenszwalb and Huttenlocher), using the lower envelope of the
+ * parabolas rooted at each sample. v and z are work arrays of n and n+1
+ * elements.
+ */
+static
+void edt_1d(const float* f, float* d, unsigned int n, int* v, float* z)
+{
+	int k = 0, q;
+	float s;
+
+	v[0] = 0;
+	z[0] = -EDT_INF;
+	z[1] = EDT_INF;
+	for (q=1; q<(int)n; q++) {
+		for (;;) {
+			s = ((f[q] + q*q) - (f[v[k]] + v[k]*v[k]))
+			    / (2*q - 2*v[k]);
+			if (s > z[k] || !k)
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k+1] = EDT_INF;
+	}
+
+	k = 0;
+	for (q=0; q<(int)n; q++) {
+		while (z[k+1] < q)
+			k++;
+		d[q] = (q-v[k])*(q-v[k]) + f[v[k]];
+	}
+}
+
+
+/* Transform in place the w x h grid g, separably along its columns then
+ * its rows. work holds 3*max(w,h)+1 floats and max(w,h) ints.
+ */
+static
+void edt_2d(float* g, unsigned int w, unsigned int h, float* work)
+{
+	unsigned int x, y, n = MAX(w, h);
+	float *f = work, *d = work + n, *z = work + 2*n;
+	int* v = (int*)(work + 3*n + 1);
+
+	for (x=0; x<w; x++) {
+		for (y=0; y<h; y++)
+			f[y] = g[y*w + x];
+		edt_1d(f, d, h, v, z);
+		for (y=0; y<h; y++)
+			g[y*w + x] = d[y];
+	}
+
+	for (y=0; y<h; y++) {
+		edt_1d(g + y*w, d, w, v, z);
+		memcpy(g + y*w, d, w*sizeof(*d));
+	}
+}
+
+
+/* Compute the signed distance field of the glyph bitmap, padded by
+ * SDF_SPREAD pixels on each side, into a w x h image. The outlines are
+ * where the coverage crosses one half. They are mapped to 128, the
+ * inside to higher values, and distances beyond SDF_SPREAD are clamped.
+ */
+static
+uint8_t* make_distance_field(const FT_Bitmap* bitmap,
+                             unsigned int w, unsigned int h)
+{
+	unsigned int x, y, i, n = MAX(w, h);
+	float *out, *in, *work, dist, val;
+	uint8_t* field;
+	bool inside;
+
+	out = malloc((2*w*h + 3*n + 1)*sizeof(*out) + n*sizeof(int));
+	field = malloc(w*h);
+	if (!out || !field) {
+		free(out);
+		free(field);
+		return NULL;
+	}
+	in = out + w*h;
+	work = in + w*h;
+
+	// Seed each grid with the pixels from which it measures distances
+	for (y=0; y<h; y++) {
+		for (x=0; x<w; x++) {
+			inside = (x >= SDF_SPREAD && y >= SDF_SPREAD
+			     && x-SDF_SPREAD < bitmap->width
+			     && y-SDF_SPREAD < bitmap->rows
+			     && bitmap->buffer[(int)(y-SDF_SPREAD)*bitmap->pitch
+			                       + x-SDF_SPREAD] >= 128);
+			out[y*w + x] = inside ? 0.0f : EDT_INF;
+			in[y*w + x] = inside ? EDT_INF : 0.0f;
+		}
+	}
+	edt_2d(out, w, h, work);
+	edt_2d(in, w, h, work);
+
+	// The outlines lie half a pixel away from the boundary pixels
+	for (i=0; i<w*h; i++) {
+		if (in[i] > 0.0f)
+			dist = sqrtf(in[i]) - 0.5f;
+		else
+			dist = 0.5f - sqrtf(out[i]);
+		val = 0.5f + dist / (2*SDF_SPREAD);
+		val = (val < 0.0f) ? 0.0f : (val > 1.0f ? 1.0f : val);
+		field[i] = (uint8_t)(255.0f*val + 0.5f);
+	}
+
+	free(out);
+	return field;
+}
+
+
+/* Load the glyph of code with face and get the image to place in the
+ * atlas (empty if it has no bitmap), and its advance. If keep is true, the
+ * image does not refer to the glyph slot of face, which can be reused.
+ * The image must be released by free_glyph_image().
+ */
+static
+int load_glyph_image(const struct dtk_font* font, FT_Face face,
+                     uint32_t code, struct glyph_image* img,
+                     float* advance, bool keep)
+{
+	FT_GlyphSlot slot = face->glyph;
+	const FT_Bitmap* bitmap = &slot->bitmap;
+	unsigned int j;
+
+	memset(img, 0, sizeof(*img));
+	if (FT_Load_Char(face, code, FT_LOAD_RENDER))
+		return -1;
+
+	if (advance)
+		*advance = slot->advance.x/((float)font->ppem*64.0f);
+	if (!bitmap->width || !bitmap->rows
+	   || bitmap->pixel_mode != FT_PIXEL_MODE_GRAY)
+		return 0;
+
+	img->w = bitmap->width;
+	img->h = bitmap->rows;
+	img->left = slot->bitmap_left;
+	img->top = slot->bitmap_top;
+	img->buffer = bitmap->buffer;
+	img->pitch = bitmap->pitch;
+
+	if (font->sdf) {
+		img->w += 2*SDF_SPREAD;
+		img->h += 2*SDF_SPREAD;
+		img->left -= SDF_SPREAD;
+		img->top += SDF_SPREAD;
+		if (!(img->field = make_distance_field(bitmap, img->w,
+		                                       img->h))) {
+			img->w = img->h = 0;
+			return -1;
+		}
+		img->buffer = img->field;
+		img->pitch = img->w;
+	} else if (keep) {
+		if (!(img->field = malloc(img->w*img->h))) {
+			img->w = img->h = 0;
+			return -1;
+		}
+		for (j=0; j<img->h; j++)
+			memcpy(img->field + j*img->w,
+			       bitmap->buffer + (int)j*bitmap->pitch, img->w);
+		img->buffer = img->field;
+		img->pitch = img->w;
+	}
+
+	return 0;
+}
+
+
+static
+void free_glyph_image(struct glyph_image* img)
+{
+	free(img->field);
+	img->field = NULL;
+}
+
+
+/**************************************************************************
+ *                              Glyph atlas                               *
+ **************************************************************************/
+/* Reserve a w x h area in the atlas: in the shelf of the smallest height
+ * that fits and does not waste more than a third of it, otherwise in a
+ * new shelf on top of the others, growing the atlas if needed.
+ * Assume that font->tex->lock is hold
+ */
+static
+int pack_glyph(struct dtk_font* font, unsigned int w, unsigned int h,
+               unsigned int* x, unsigned int* y)
+{
+	struct dtk_texture* tex = font->tex;
+	struct shelf *sh, *best = NULL;
+	unsigned int i, top = 0, texh = tex->data[0].h;
+
+	if (w > ATLAS_WIDTH)
 		return -1;
+
+	for (i=0; i<font->nshelves; i++) {
+		sh = font->shelves + i;
+		if (sh->h >= h && 2*sh->h <= 3*h && ATLAS_WIDTH - sh->x >= w
+		   && (!best || sh->h < best->h))
+			best = sh;
 	}
 
-	FT_Set_Pixel_Sizes(face, CHWIDTH, CHHEIGHT);
-	//max_size = MAX(face->max_advance_width, face->max_advance_height);
-	get_max_size(face, &h, &w);
-	max_size = MAX(h, w);
-	ppem = maxsc * ((SIZE * SIZE) / (max_size * maxsc));
-	//FT_Set_Pixel_Sizes(face, (unsigned int)ppem, (unsigned int)ppem);
+	if (!best) {
+		if (font->nshelves)
+			top = font->shelves[font->nshelves-1].y
+			      + font->shelves[font->nshelves-1].h;
+		h = (h + SHELF_ROUND-1) / SHELF_ROUND * SHELF_ROUND;
+		if (top + h > ATLAS_MAXHEIGHT)
+			return -1;
 
-	for (i = 32; i < 256; i++) 
-		for (lvl = 0; lvl <= mxlvl; lvl++)
-			render_char(face, bits[lvl], i, font, ppem, lvl);
+		while (top + h > texh)
+			texh *= 2;
+		if (texh != tex->data[0].h && grow_image_data(tex, texh))
+			return -1;
 
-	FT_Done_Face(face);
-	FT_Done_FreeType(library);
+		sh = realloc(font->shelves,
+		             (font->nshelves+1)*sizeof(*font->shelves));
+		if (!sh)
+			return -1;
+		font->shelves = sh;
+		best = sh + font->nshelves++;
+		best->y = top;
+		best->h = h;
+		best->x = 0;
+	}
+
+	*x = best->x;
+	*y = best->y;
+	best->x += w;
 	return 0;
 }
 
+
+/* Copy the image of a glyph to its place in the atlas. Rows are stored
+ * from bottom to top.
+ * Assume that font->tex->lock is hold
+ */
+static
+void copy_glyph_image(struct dtk_font* font, const struct glyph* gl,
+                      const struct glyph_image* img)
+{
+	const struct mipmapdata* mm = font->tex->data;
+	uint8_t* bits = font->tex->bmdata;
+	unsigned int j;
+
+	for (j=0; j<gl->h; j++)
+		memcpy(bits + (gl->y + gl->h-1 - j)*mm->stride + gl->x,
+		       img->buffer + (int)j*img->pitch, gl->w);
+}
+
+
+/* Place the image of a glyph in the atlas and set the geometry of its
+ * character. If the image is empty or the atlas is full, the character
+ * only keeps its advance.
+ * Assume that font->tex->lock is hold and the image data allocated
+ */
+static
+void place_glyph(struct dtk_font* font, struct glyph* gl,
+                 const struct glyph_image* img)
+{
+	struct character* ch = &gl->ch;
+	float unit = font->unit;
+	unsigned int x, y;
+
+	gl->w = gl->h = 0;
+	if (!img->w || pack_glyph(font, img->w + 2*GLYPH_PAD,
+	                          img->h + 2*GLYPH_PAD, &x, &y))
+		return;
+
+	gl->x = x + GLYPH_PAD;
+	gl->y = y + GLYPH_PAD;
+	gl->w = img->w;
+	gl->h = img->h;
+	copy_glyph_image(font, gl, img);
+	mark_texture_dirty(font->tex, gl->x, gl->y, gl->w, gl->h);
+
+	ch->xmin = img->left/unit;
+	ch->xmax = (img->left + (int)gl->w)/unit;
+	ch->ymin = (img->top - (int)gl->h)/unit;
+	ch->ymax = img->top/unit;
+	ch->txmin = gl->x/(float)ATLAS_WIDTH;
+	ch->txmax = (gl->x + gl->w)/(float)ATLAS_WIDTH;
+	ch->tymin = gl->y/(float)ATLAS_MAXHEIGHT;
+	ch->tymax = (gl->y + gl->h)/(float)ATLAS_MAXHEIGHT;
+}
+
+
+/* Render the glyph of gl->code and place it in the atlas
+ * Assume that font->tex->lock is hold and the image data allocated
+ */
+static
+void render_glyph(struct dtk_font* font, struct glyph* gl)
+{
+	struct glyph_image img = {.field = NULL};
+
+	memset(&gl->ch, 0, sizeof(gl->ch));
+	if (!open_glyph_face(font)
+	   && !load_glyph_image(font, font->face, gl->code, &img,
+	                        &gl->ch.advance, false))
+		place_glyph(font, gl, &img);
+	else
+		gl->w = gl->h = 0;
+	free_glyph_image(&img);
+}
+
+
+/* Render again the glyphs dropped by the texture manager
+ * Assume that tex->lock is hold
+ */
+static
+int font_reload(struct dtk_texture* tex)
+{
+	struct dtk_font* font = tex->aux;
+	struct glyph_image img = {.field = NULL};
+	struct glyph* gl;
+	unsigned int i;
+
+	if (!(tex->bmdata = calloc(1, texture_data_size(tex))))
+		return -1;
+
+	for (i=0; i<font->size; i++) {
+		gl = font->glyphs + i;
+		if (gl->w && !open_glyph_face(font)
+		   && !load_glyph_image(font, font->face, gl->code, &img,
+		                        NULL, false)
+		   && img.w == gl->w && img.h == gl->h)
+			copy_glyph_image(font, gl, &img);
+		free_glyph_image(&img);
+	}
+
+	return 0;
+}
+
+
+static
+unsigned int find_glyph_slot(const struct dtk_font* font, uint32_t code)
+{
+	unsigned int i = (code * 2654435761u) & (font->size-1);
+
+	while (font->glyphs[i].code && font->glyphs[i].code != code)
+		i = (i+1) & (font->size-1);
+
+	return i;
+}
+
+
+static
+int resize_glyph_table(struct dtk_font* font, unsigned int size)
+{
+	struct glyph* old = font->glyphs;
+	unsigned int i, oldsize = font->size;
+
+	if (!(font->glyphs = calloc(size, sizeof(*old)))) {
+		font->glyphs = old;
+		return -1;
+	}
+
+	font->size = size;
+	for (i=0; i<oldsize; i++)
+		if (old[i].code)
+			font->glyphs[find_glyph_slot(font, old[i].code)]
+			                                            = old[i];
+	free(old);
+	return 0;
+}
+
+
+/* Add an empty entry for code, which must not be in the glyph table.
+ * Returns NULL if it cannot be added.
+ */
+static
+struct glyph* insert_glyph(struct dtk_font* font, uint32_t code)
+{
+	struct glyph* gl;
+
+	// Keep the load factor below 3/4
+	if (4*(font->num+1) > 3*font->size
+	   && resize_glyph_table(font, 2*font->size))
+		return NULL;
+
+	gl = font->glyphs + find_glyph_slot(font, code);
+	gl->code = code;
+	font->num++;
+	font->cachedirty = true;
+	return gl;
+}
+
+
+/* Get the glyph of a codepoint, rendering it the first time it is used.
+ * Returns NULL if it cannot be added to the glyph table.
+ * Assume that font->tex->lock is hold
+ */
+static
+const struct glyph* get_glyph(struct dtk_font* font, uint32_t code)
+{
+	struct glyph* gl;
+
+	gl = font->glyphs + find_glyph_slot(font, code);
+	if (gl->code)
+		return gl;
+
+	// The image data may have been dropped once uploaded
+	if (!font->tex->bmdata && font_reload(font->tex))
+		return NULL;
+
+	if ((gl = insert_glyph(font, code)))
+		render_glyph(font, gl);
+	return gl;
+}
+
+
+/**************************************************************************
+ *                         Parallel rasterization                         *
+ **************************************************************************/
+// Consecutive glyphs rendered with the same face. A job is rendered by
+// the thread that claims it first: a worker or the caller.
+struct raster_job {
+	const struct dtk_font* font;
+	FT_Face face;
+	const uint32_t* codes;
+	struct glyph_image* imgs;
+	float* advances;
+	unsigned int num;
+	bool claimed;
+	struct raster_batch* batch;
+};
+
+// Jobs of one call to render_glyphs(). The work queued for a job claimed
+// by the caller may run after the call, so the batch is freed by the
+// last of the caller and the queued works.
+struct raster_batch {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned int finished, refs;
+	struct raster_job jobs[FONT_NWORKFACES+1];
+};
+
+
+static
+void raster_glyphs(const struct raster_job* job)
+{
+	unsigned int i;
+
+	for (i=0; i<job->num; i++)
+		load_glyph_image(job->font, job->face, job->codes[i],
+		                 job->imgs + i, job->advances + i, true);
+}
+
+
+static
+void release_raster_batch(struct raster_batch* batch, bool finished)
+{
+	unsigned int refs;
+
+	pthread_mutex_lock(&batch->lock);
+	if (finished) {
+		batch->finished++;
+		pthread_cond_signal(&batch->cond);
+	}
+	refs = --batch->refs;
+	pthread_mutex_unlock(&batch->lock);
+
+	if (refs)
+		return;
+	pthread_mutex_destroy(&batch->lock);
+	pthread_cond_destroy(&batch->cond);
+	free(batch);
+}
+
+
+static
+void raster_work(void* arg)
+{
+	struct raster_job* job = arg;
+	bool claimed;
+
+	// The job may have been rendered by the caller meanwhile
+	claimed = !__atomic_exchange_n(&job->claimed, true, __ATOMIC_ACQ_REL);
+	if (claimed)
+		raster_glyphs(job);
+
+	release_raster_batch(job->batch, claimed);
+}
+
+
+/* Render the glyphs of the new codepoints, whose entries are empty in the
+ * glyph table. The codepoints are split in ranges rendered by the caller
+ * and the worker threads, each with its own face. The pool is shared with
+ * slower work (image decoding, video prerolls): the caller renders the
+ * ranges not started yet by a worker rather than waiting for them. The
+ * images are then placed in the atlas in order, so the layout does not
+ * depend on the scheduling.
+ * Assume that font->tex->lock is hold and the image data allocated
+ */
+static
+void render_glyphs(struct dtk_font* font, const uint32_t* codes,
+                   unsigned int num)
+{
+	struct raster_batch* batch;
+	struct raster_job* jobs;
+	struct glyph_image* imgs;
+	struct glyph* gl;
+	float* advances;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i, k, njob, nbusy = 0, first = 0;
+
+	imgs = calloc(num, sizeof(*imgs));
+	advances = calloc(num, sizeof(*advances));
+	batch = calloc(1, sizeof(*batch));
+	if (!imgs || !advances || !batch || open_glyph_face(font)) {
+		free(batch);
+		for (i=0; i<num; i++)
+			render_glyph(font, font->glyphs
+			                   + find_glyph_slot(font, codes[i]));
+		goto exit;
+	}
+
+	njob = (num + RASTER_CHUNK-1) / RASTER_CHUNK;
+	if (njob > FONT_NWORKFACES+1)
+		njob = FONT_NWORKFACES+1;
+	if (ncpu > 0 && njob > (unsigned int)ncpu)
+		njob = ncpu;
+
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->cond, NULL);
+	batch->refs = 1;
+	jobs = batch->jobs;
+	for (k=0; k<njob; k++) {
+		jobs[k].font = font;
+		jobs[k].face = font->face;
+		jobs[k].codes = codes + first;
+		jobs[k].imgs = imgs + first;
+		jobs[k].advances = advances + first;
+		jobs[k].num = (num - first) / (njob - k);
+		jobs[k].claimed = false;
+		jobs[k].batch = batch;
+		first += jobs[k].num;
+	}
+
+	// The ranges that cannot be given to a worker are rendered by the
+	// caller with the main face
+	for (k=1; k<njob; k++) {
+		if (open_work_face(font, k-1))
+			continue;
+		jobs[k].face = font->wface[k-1];
+		pthread_mutex_lock(&batch->lock);
+		batch->refs++;
+		pthread_mutex_unlock(&batch->lock);
+		if (submit_work(raster_work, jobs + k)) {
+			pthread_mutex_lock(&batch->lock);
+			batch->refs--;
+			pthread_mutex_unlock(&batch->lock);
+			jobs[k].face = font->face;
+		}
+	}
+	for (k=0; k<njob; k++)
+		if (jobs[k].face == font->face)
+			raster_glyphs(jobs + k);
+
+	// Render the ranges not started yet and wait only for the others
+	for (k=1; k<njob; k++) {
+		if (jobs[k].face == font->face)
+			continue;
+		if (__atomic_exchange_n(&jobs[k].claimed, true,
+		                        __ATOMIC_ACQ_REL))
+			nbusy++;
+		else
+			raster_glyphs(jobs + k);
+	}
+	pthread_mutex_lock(&batch->lock);
+	while (batch->finished < nbusy)
+		pthread_cond_wait(&batch->cond, &batch->lock);
+	pthread_mutex_unlock(&batch->lock);
+	release_raster_batch(batch, false);
+
+	for (i=0; i<num; i++) {
+		gl = font->glyphs + find_glyph_slot(font, codes[i]);
+		memset(&gl->ch, 0, sizeof(gl->ch));
+		gl->ch.advance = advances[i];
+		place_glyph(font, gl, imgs + i);
+		free_glyph_image(imgs + i);
+	}
+
+exit:
+	free(imgs);
+	free(advances);
+}
+
+
+/* Add the glyphs of the new codepoints of a sequence if there are enough
+ * of them to be rendered in parallel. The others are rendered by
+ * get_glyph().
+ * Assume that font->tex->lock is hold
+ */
+static
+void add_glyphs(struct dtk_font* font, const uint32_t* codes,
+                unsigned int num)
+{
+	uint32_t* newcodes;
+	unsigned int i, nnew = 0;
+
+	// Count first (with repetitions) to not allocate anything when
+	// all the glyphs are known
+	for (i=0; i<num; i++)
+		if (codes[i] >= 32
+		   && !font->glyphs[find_glyph_slot(font, codes[i])].code)
+			nnew++;
+
+	// The image data may have been dropped once uploaded
+	if (nnew < RASTER_MIN
+	   || (!font->tex->bmdata && font_reload(font->tex))
+	   || !(newcodes = malloc(nnew*sizeof(*newcodes))))
+		return;
+
+	nnew = 0;
+	for (i=0; i<num; i++)
+		if (codes[i] >= 32
+		   && !font->glyphs[find_glyph_slot(font, codes[i])].code
+		   && insert_glyph(font, codes[i]))
+			newcodes[nnew++] = codes[i];
+
+	render_glyphs(font, newcodes, nnew);
+	free(newcodes);
+}
+
+
+/**************************************************************************
+ *                              Atlas cache                               *
+ **************************************************************************/
+/* Returns the path of the cache file of the font identified by key (its
+ * texture descriptor), or NULL if there is no user cache directory
+ */
+static
+char* get_cache_path(const char* key)
+{
+	const char *base, *sub = "";
+	const unsigned char* s;
+	uint64_t h = 14695981039346656037ULL;
+	char* path;
+
+	// FNV-1a hash of the key
+	for (s = (const unsigned char*)key; *s; s++)
+		h = (h ^ *s) * 1099511628211ULL;
+
+	base = getenv("XDG_CACHE_HOME");
+	if (!base || !*base) {
+		if (!(base = getenv("HOME")) || !*base)
+			return NULL;
+		sub = "/.cache";
+	}
+
+	path = malloc(strlen(base) + strlen(sub) + sizeof(CACHE_DIR)
+	              + sizeof(CACHE_SUFFIX) + 20);
+	if (path)
+		sprintf(path, "%s%s/" CACHE_DIR "/%016llx" CACHE_SUFFIX,
+		        base, sub, (unsigned long long)h);
+	return path;
+}
+
+
+/* Create the missing directories of path
+ */
+static
+int make_parent_dirs(char* path)
+{
+	char* s;
+	int error;
+
+	for (s = strchr(path+1, '/'); s; s = strchr(s+1, '/')) {
+		*s = '\0';
+		error = (mkdir(path, 0700) && errno != EEXIST);
+		*s = '/';
+		if (error)
+			return -1;
+	}
+
+	return 0;
+}
+
+
+static
+void fill_cache_params(uint32_t* params)
+{
+	params[0] = SIZE;
+	params[1] = ATLAS_WIDTH;
+	params[2] = ATLAS_MAXHEIGHT;
+	params[3] = GLYPH_PAD;
+	params[4] = SDF_DOWNSCALE;
+	params[5] = SDF_SPREAD;
+	params[6] = sizeof(struct glyph);
+	params[7] = sizeof(struct shelf);
+}
+
+
+static
+void update_cache_stats(unsigned long* counter)
+{
+	pthread_mutex_lock(&cachestats.lock);
+	(*counter)++;
+	pthread_mutex_unlock(&cachestats.lock);
+}
+
+
+/* Tell whether a rectangle of the atlas read from a cache file lies in
+ * the atlas of height h (beware of overflows)
+ */
+static
+bool check_cache_rect(unsigned int x, unsigned int y,
+                      unsigned int w, unsigned int h, unsigned int height)
+{
+	return x <= ATLAS_WIDTH && w <= ATLAS_WIDTH - x
+	       && y <= height && h <= height - y;
+}
+
+
+/* Fill the font and its atlas from the cache file if it has been written
+ * with the same parameters for the current version of the font file.
+ * Neither fontconfig nor FreeType are used: the face is opened only when
+ * a glyph missing from the cache is requested.
+ * Assume that font->tex->lock is hold
+ */
+static
+int read_font_cache(struct dtk_font* font, bool sdf)
+{
+	struct cache_header hdr;
+	struct stat st;
+	struct glyph gl;
+	struct dtk_texture* tex = font->tex;
+	const char* key = tex->desc;
+	const uint8_t *map = MAP_FAILED, *p;
+	struct shelf* sh;
+	size_t size = 0;
+	unsigned int i, slot;
+	uint32_t params[8];
+	int fd;
+
+	if ((fd = open(font->cachefile, O_RDONLY)) < 0)
+		return -1;
+	if (!fstat(fd, &st) && st.st_size >= (off_t)sizeof(hdr)) {
+		size = st.st_size;
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	// Check the parameters and the key before the version of the file
+	memcpy(&hdr, map, sizeof(hdr));
+	fill_cache_params(params);
+	p = map + sizeof(hdr);
+	if (memcmp(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC))
+	   || memcmp(hdr.params, params, sizeof(params))
+	   || hdr.height < ATLAS_MINHEIGHT || hdr.height > ATLAS_MAXHEIGHT
+	   || !hdr.ppem || !hdr.unit
+	   || size != sizeof(hdr) + hdr.keylen + hdr.pathlen
+	              + (size_t)hdr.nglyphs*sizeof(gl)
+	              + (size_t)hdr.nshelves*sizeof(struct shelf)
+	              + (size_t)hdr.height*ATLAS_WIDTH
+	   || hdr.keylen != strlen(key) || memcmp(p, key, hdr.keylen)
+	   || !(font->filename = strndup((const char*)p + hdr.keylen,
+	                                 hdr.pathlen))
+	   || stat(font->filename, &st)
+	   || (uint64_t)st.st_size != hdr.filesize
+	   || (int64_t)st.st_mtime != hdr.mtime)
+		goto error;
+	p += hdr.keylen + hdr.pathlen;
+
+	// Rebuild the glyph table
+	font->size = GLYPHTABLE_MINSIZE;
+	while (4*hdr.nglyphs > 3*font->size)
+		font->size *= 2;
+	if (!(font->glyphs = calloc(font->size, sizeof(gl))))
+		goto error;
+	for (i=0; i<hdr.nglyphs; i++, p += sizeof(gl)) {
+		// Reject corrupted files rather than writing out of the atlas
+		memcpy(&gl, p, sizeof(gl));
+		slot = find_glyph_slot(font, gl.code);
+		if (!gl.code || font->glyphs[slot].code
+		   || !check_cache_rect(gl.x, gl.y, gl.w, gl.h, hdr.height))
+			goto error;
+		font->glyphs[slot] = gl;
+	}
+	font->num = hdr.nglyphs;
+
+	if (hdr.nshelves) {
+		font->shelves = malloc(hdr.nshelves*sizeof(struct shelf));
+		if (!font->shelves)
+			goto error;
+		memcpy(font->shelves, p, hdr.nshelves*sizeof(struct shelf));
+		p += hdr.nshelves*sizeof(struct shelf);
+	}
+	font->nshelves = hdr.nshelves;
+	for (i=0; i<hdr.nshelves; i++) {
+		sh = font->shelves + i;
+		if (!check_cache_rect(sh->x, sh->y, 0, sh->h, hdr.height))
+			goto error;
+	}
+
+	if (alloc_image_data(tex, ATLAS_WIDTH, hdr.height, 0, 8))
+		goto error;
+	for (i=0; i<hdr.height; i++, p += ATLAS_WIDTH)
+		memcpy((uint8_t*)tex->bmdata + i*tex->data[0].stride,
+		       p, ATLAS_WIDTH);
+
+	font->faceidx = hdr.faceidx;
+	font->filesize = hdr.filesize;
+	font->mtime = hdr.mtime;
+	font->ppem = hdr.ppem;
+	font->unit = hdr.unit;
+	font->sdf = sdf;
+	munmap((void*)map, size);
+	return 0;
+
+error:
+	free(font->filename);
+	free(font->glyphs);
+	free(font->shelves);
+	font->filename = NULL;
+	font->glyphs = NULL;
+	font->shelves = NULL;
+	font->nshelves = font->num = 0;
+	munmap((void*)map, size);
+	return -1;
+}
+
+
+/* Write the glyphs and the atlas of the font to its cache file. The file
+ * is replaced atomically.
+ */
+static
+int write_font_cache(struct dtk_font* font)
+{
+	struct cache_header hdr;
+	struct dtk_texture* tex = font->tex;
+	const char* key = tex->desc;
+	char* tmppath;
+	FILE* fp = NULL;
+	unsigned int i;
+	int fd = -1, ret = 0;
+
+	// The image data may have been dropped once uploaded
+	if (!tex->bmdata && font_reload(tex))
+		return -1;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	fill_cache_params(hdr.params);
+	hdr.filesize = font->filesize;
+	hdr.mtime = font->mtime;
+	hdr.faceidx = font->faceidx;
+	hdr.ppem = font->ppem;
+	hdr.unit = font->unit;
+	hdr.keylen = strlen(key);
+	hdr.pathlen = strlen(font->filename);
+	hdr.nglyphs = font->num;
+	hdr.nshelves = font->nshelves;
+	hdr.height = tex->data[0].h;
+
+	if (!(tmppath = malloc(strlen(font->cachefile) + 8)))
+		return -1;
+	sprintf(tmppath, "%s.XXXXXX", font->cachefile);
+	if (make_parent_dirs(tmppath)
+	   || (fd = mkstemp(tmppath)) < 0
+	   || !(fp = fdopen(fd, "wb"))) {
+		if (fd >= 0) {
+			close(fd);
+			unlink(tmppath);
+		}
+		free(tmppath);
+		return -1;
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+	   || fwrite(key, 1, hdr.keylen, fp) != hdr.keylen
+	   || fwrite(font->filename, 1, hdr.pathlen, fp) != hdr.pathlen)
+		ret = -1;
+	for (i=0; i<font->size && !ret; i++)
+		if (font->glyphs[i].code
+		   && fwrite(font->glyphs+i, sizeof(struct glyph), 1, fp) != 1)
+			ret = -1;
+	if (!ret && hdr.nshelves && fwrite(font->shelves,
+	         sizeof(struct shelf), hdr.nshelves, fp) != hdr.nshelves)
+		ret = -1;
+	for (i=0; i<hdr.height && !ret; i++)
+		if (fwrite((uint8_t*)tex->bmdata + i*tex->data[0].stride,
+		           ATLAS_WIDTH, 1, fp) != 1)
+			ret = -1;
+
+	// Publish the cache atomically
+	if (fclose(fp) || ret || rename(tmppath, font->cachefile)) {
+		unlink(tmppath);
+		ret = -1;
+	}
+
+	free(tmppath);
+	return ret;
+}
+
+
+/* Open the font with the glyphs and the atlas of its cache if it is
+ * valid, otherwise with an empty atlas
+ * Assume that tex->lock is hold
+ */
+static
+int open_font(struct dtk_font* font, struct dtk_texture* tex,
+              const char* fontname, bool sdf)
+{
+	font->tex = tex;
+	font->cachefile = get_cache_path(tex->desc);
+	if (font->cachefile && !read_font_cache(font, sdf)) {
+		update_cache_stats(&cachestats.hits);
+		return 0;
+	}
+
+	// The cache will be written when the font is destroyed
+	update_cache_stats(&cachestats.misses);
+	font->cachedirty = true;
+	if (init_font(font, fontname, sdf)
+	   || alloc_image_data(tex, ATLAS_WIDTH, ATLAS_MINHEIGHT, 0, 8)) {
+		close_font(font);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Decode the UTF-8 string text into codes (if not NULL) and return the
+ * number of codepoints. Invalid sequences are replaced by U+FFFD.
+ */
+LOCAL_FN
+unsigned int utf8_decode(const char* text, uint32_t* codes)
+{
+	const unsigned char* s = (const unsigned char*)text;
+	unsigned int i, len, num = 0;
+	uint32_t c, min = 0;
+
+	while (*s) {
+		c = *s;
+		len = 1;
+		if (c >= 0xF0 && c < 0xF8) {
+			len = 4;
+			c &= 0x07;
+			min = 0x10000;
+		} else if (c >= 0xE0 && c < 0xF0) {
+			len = 3;
+			c &= 0x0F;
+			min = 0x800;
+		} else if (c >= 0xC0 && c < 0xE0) {
+			len = 2;
+			c &= 0x1F;
+			min = 0x80;
+		} else if (c >= 0x80)
+			c = REPLACEMENT_CHAR;
+
+		// Continuation bytes
+		for (i=1; i<len && (s[i] & 0xC0) == 0x80; i++)
+			c = (c << 6) | (s[i] & 0x3F);
+
+		// Reject truncated and overlong sequences and surrogates
+		if (len > 1 && (i < len || c < min || c > 0x10FFFF
+		                || (c >= 0xD800 && c <= 0xDFFF)))
+			c = REPLACEMENT_CHAR;
+
+		if (codes)
+			codes[num] = c;
+		num++;
+		s += i;
+	}
+
+	return num;
+}
+
+
+/* Get the characters of a sequence of codepoints. The control
+ * characters and the glyphs that cannot be rendered are empty.
+ */
+LOCAL_FN
+void get_font_glyphs(struct dtk_font* font, const uint32_t* codes,
+                     unsigned int num, struct character* chars)
+{
+	const struct glyph* gl;
+	unsigned int i;
+
+	pthread_mutex_lock(&font->tex->lock);
+	add_glyphs(font, codes, num);
+	for (i=0; i<num; i++) {
+		gl = (codes[i] >= 32) ? get_glyph(font, codes[i]) : NULL;
+		if (gl)
+			chars[i] = gl->ch;
+		else
+			memset(chars+i, 0, sizeof(*chars));
+	}
+	pthread_mutex_unlock(&font->tex->lock);
+}
+
+
 static
 void font_destroy(struct dtk_texture* tex)
 {
-        free(tex->aux);
+	struct dtk_font* font = tex->aux;
+
+	if (font->cachefile && font->cachedirty && !write_font_cache(font))
+		update_cache_stats(&cachestats.writes);
+
+	close_font(font);
+	free(font);
 }
 
 
 LOCAL_FN
-int dtk_char_pos(const struct dtk_font* restrict font, unsigned char c,
+int dtk_char_pos(const struct character* restrict ch,
                  float* restrict vert, float* restrict texcoords,
 		 unsigned int * restrict ind,
 		 unsigned int currind, float * restrict org)
 {
-	const struct character* restrict ch;
 	float pos = *org;
-	if (c < 32) {
-		memset(vert, 0, 4*sizeof(*vert));
-		memset(texcoords, 0, 4*sizeof(*texcoords));
-		memset(ind, 0, 6*sizeof(*ind));
-		return 6;
-	}
-
-	ch = &(font->ch[c-32]);
 
 	vert[0] = ch->xmin + pos;
 	vert[1] = ch->ymin;
@@ -241,43 +1370,44 @@ struct dtk_texture* dtk_get_fonttex(const struct dtk_font* font)
 
 
 API_EXPORTED
-struct dtk_font* dtk_load_font(const char* fontname)
+struct dtk_font* dtk_load_font_ex(const char* fontname, unsigned int flags)
 {
-	int i, fail = 0;
+	int fail = 0;
 	struct dtk_texture *tex = NULL;
 	struct dtk_font* font = NULL;
 	char stringid[256];
-	void* bits[FONT_MXLVL+1];
 	
 	// Get new/precreated texture
-	snprintf(stringid, sizeof(stringid), "FONT:%s", fontname);
+	snprintf(stringid, sizeof(stringid), "%s%s",
+	         (flags & DTK_FONT_SDF) ? SDFFONT_PREFIX : FONT_PREFIX,
+	         fontname);
 	if ((tex = get_texture(stringid)) == NULL)
 		return NULL;
 
-	// Load the font bitmap
+	// Open the font with the atlas of its cache or an empty one: the
+	// glyphs are rendered when first used
 	pthread_mutex_lock(&(tex->lock));
 	if (!tex->data) {
-		if ( ((font = malloc(sizeof(struct dtk_font))) == NULL)
-		    || alloc_image_data(tex, MAPWIDTH, MAPHEIGHT,
-		                             FONT_MXLVL, 8) )
-			fail = 1;
-		tex->aux = font;
-		font->tex = tex;
-
-		for (i=0; i<FONT_MXLVL+1; i++)
-			bits[i]	= ((char*)tex->bmdata)+tex->data[i].offset;
-		if (load_glyph(bits, tex->aux, fontname, FONT_MXLVL))
+		if (!(font = calloc(1, sizeof(*font)))
+		    || open_font(font, tex, fontname, flags & DTK_FONT_SDF)) {
+			free(font);
 			fail = 1;
-		tex->destroyfn = font_destroy;
+		} else {
+			tex->aux = font;
+			tex->tcheight = ATLAS_MAXHEIGHT;
+			tex->destroyfn = font_destroy;
+			tex->reloadfn = font_reload;
+			tex->sdf = font->sdf;
 
-		tex->fmt = GL_ALPHA;
-		tex->type = GL_UNSIGNED_BYTE;
-		tex->intfmt = GL_ALPHA;
+			tex->fmt = GL_ALPHA;
+			tex->type = GL_UNSIGNED_BYTE;
+			tex->intfmt = GL_ALPHA;
+		}
 	}
+	font = tex->aux;
 	pthread_mutex_unlock(&(tex->lock));
 
 	if (fail) {
-		free(font);
 		rem_texture(tex);
 		return NULL;
 	}
@@ -285,8 +1415,26 @@ struct dtk_font* dtk_load_font(const char* fontname)
 }
 
 
+API_EXPORTED
+struct dtk_font* dtk_load_font(const char* fontname)
+{
+	return dtk_load_font_ex(fontname, 0);
+}
+
+
 API_EXPORTED
 void dtk_destroy_font(struct dtk_font* font)
 {
 	rem_texture(font->tex);
 }
+
+
+API_EXPORTED
+void dtk_font_getcachestats(struct dtk_font_cachestats* stats)
+{
+	pthread_mutex_lock(&cachestats.lock);
+	stats->hits = cachestats.hits;
+	stats->misses = cachestats.misses;
+	stats->writes = cachestats.writes;
+	pthread_mutex_unlock(&cachestats.lock);
+}
@@ -19,8 +19,10 @@
 #ifndef FONTTEX_H
 #define FONTTEX_H
 
-
-#define NUMCHAR		(256-32)
+#include <stdbool.h>
+#include <stdint.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
 
 struct character {
 	float advance;
@@ -28,14 +30,69 @@ struct character {
 	float txmin, txmax, tymin, tymax;
 };
 
+// Glyph cached in the atlas, keyed by its codepoint (0 if the entry is
+// free). w and h is the size of its bitmap at x, y in the atlas.
+struct glyph {
+	uint32_t code;
+	unsigned int x, y, w, h;
+	struct character ch;
+};
+
+// Row of the atlas into which glyphs of similar heights are packed from
+// left to right
+struct shelf {
+	unsigned int y, h, x;
+};
+
+// Maximum number of worker threads rendering glyphs in parallel
+#define FONT_NWORKFACES	3
+
+/* The glyphs are rendered when first used and packed into the alpha
+ * texture tex, whose height grows as shelves are added. The glyph table
+ * is an open addressing hash table (linear probing). All the fields are
+ * protected by tex->lock.
+ * If sdf is set, the atlas holds the signed distance fields of the
+ * glyphs. unit is the number of pixels of the rendered glyphs per unit
+ * of the shape coordinates.
+ */
 struct dtk_font {
 	struct dtk_texture* tex;
-	unsigned int pixwidth, pixheight;
-	struct character ch[NUMCHAR];
+	FT_Library library;
+	FT_Face face;
+	unsigned int ppem, unit;
+	bool sdf;
+
+	// Face of the font file, opened only when a glyph must be rendered
+	// if the font has been loaded from the atlas cache, and version of
+	// the file
+	char* filename;
+	int faceidx;
+	uint64_t filesize;
+	int64_t mtime;
+
+	// Faces opened by the worker threads, when needed
+	FT_Library wlibrary[FONT_NWORKFACES];
+	FT_Face wface[FONT_NWORKFACES];
+
+	// Cache file of the atlas (NULL if there is no cache directory),
+	// written when destroyed if glyphs have been added
+	char* cachefile;
+	bool cachedirty;
+
+	struct glyph* glyphs;
+	unsigned int size, num;
+
+	struct shelf* shelves;
+	unsigned int nshelves;
 };
 
 LOCAL_FN
-int dtk_char_pos(const struct dtk_font* restrict font, unsigned char c,
+unsigned int utf8_decode(const char* text, uint32_t* codes);
+LOCAL_FN
+void get_font_glyphs(struct dtk_font* font, const uint32_t* codes,
+                     unsigned int num, struct character* chars);
+LOCAL_FN
+int dtk_char_pos(const struct character* restrict ch,
                  float* restrict vert, float* restrict texcoords,
 		 unsigned int * restrict ind,
 		 unsigned int currind, float * restrict org);
@@ -21,9 +21,21 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <FreeImage.h>
 #include "drawtk.h"
 #include "texmanager.h"
+#include "workpool.h"
+
+#define IMAGE_PREFIX	"IMAGE:"
+
+struct image_load
+{
+	struct dtk_texture* tex;
+	unsigned int mxlvl;
+	char filename[];
+};
 
 static
 int find_dib_color_settings(FIBITMAP *dib, GLint* intfmt,
@@ -130,6 +142,108 @@ out:
 }
 
 
+/* Load again the image data dropped by the texture manager
+ * Assume that tex->lock is hold
+ */
+static
+int reload_image_data(struct dtk_texture* tex)
+{
+	struct dtk_texture tmp;
+	const char* filename = tex->desc + strlen(IMAGE_PREFIX);
+	int fail;
+
+	memset(&tmp, 0, sizeof(tmp));
+	if (load_texture_from_file(&tmp, filename, tex->mxlvl))
+		return -1;
+
+	// The file may have been modified in between
+	fail = (tmp.bpp != tex->bpp || tmp.data[0].w != tex->data[0].w
+	        || tmp.data[0].h != tex->data[0].h);
+	if (!fail) {
+		tex->bmdata = tmp.bmdata;
+		tmp.bmdata = NULL;
+	}
+	free(tmp.bmdata);
+	free(tmp.data);
+	return fail ? -1 : 0;
+}
+
+
+/* Decode the image on a worker thread into a temporary structure and
+ * publish the result in the texture.
+ */
+static
+void load_image_work(void* arg)
+{
+	struct image_load* load = arg;
+	struct dtk_texture *tex = load->tex, tmp;
+	int fail;
+
+	memset(&tmp, 0, sizeof(tmp));
+	fail = load_texture_from_file(&tmp, load->filename, load->mxlvl);
+
+	pthread_mutex_lock(&tex->lock);
+	if (!fail) {
+		tex->data = tmp.data;
+		tex->bmdata = tmp.bmdata;
+		tex->mxlvl = tmp.mxlvl;
+		tex->bpp = tmp.bpp;
+		tex->intfmt = tmp.intfmt;
+		tex->fmt = tmp.fmt;
+		tex->type = tmp.type;
+		tex->rmsk = tmp.rmsk;
+		tex->gmsk = tmp.gmsk;
+		tex->bmsk = tmp.bmsk;
+		tex->glmipmap = tmp.glmipmap;
+		tex->reloadfn = reload_image_data;
+	}
+	tex->loading = false;
+	pthread_cond_broadcast(&tex->cond);
+	pthread_mutex_unlock(&tex->lock);
+
+	free(load);
+}
+
+
+API_EXPORTED
+struct dtk_texture* dtk_load_image_async(const char* filename,
+                                         unsigned int mxlvl)
+{
+	struct dtk_texture *tex = NULL;
+	struct image_load* load;
+	char stringid[256];
+	
+	// Get new/precreated texture
+	snprintf(stringid, sizeof(stringid), IMAGE_PREFIX "%s", filename);
+	if ((tex = get_texture(stringid)) == NULL)
+		return NULL;
+
+	// Queue the loading if not loaded nor being loaded
+	pthread_mutex_lock(&(tex->lock));
+	if (!tex->data && !tex->loading) {
+		load = malloc(sizeof(*load) + strlen(filename) + 1);
+		if (load) {
+			load->tex = tex;
+			load->mxlvl = mxlvl;
+			strcpy(load->filename, filename);
+			tex->loading = true;
+			if (submit_work(load_image_work, load)) {
+				tex->loading = false;
+				free(load);
+			}
+		}
+		if (!tex->loading) {
+			pthread_mutex_unlock(&(tex->lock));
+			rem_texture(tex);
+			return NULL;
+		}
+	}
+	pthread_mutex_unlock(&(tex->lock));
+
+	return tex;
+}
+
+
 API_EXPORTED
 struct dtk_texture* dtk_load_image(const char* filename, unsigned int mxlvl)
 {
@@ -138,14 +252,18 @@ struct dtk_texture* dtk_load_image(const char* filename, unsigned int mxlvl)
 	char stringid[256];
 	
 	// Get new/precreated texture
-	snprintf(stringid, sizeof(stringid), "IMAGE:%s", filename);
+	snprintf(stringid, sizeof(stringid), IMAGE_PREFIX "%s", filename);
 	if ((tex = get_texture(stringid)) == NULL)
 		return NULL;
 
-	// Load the image file
+	// Load the image file (once a pending asynchronous load is over)
 	pthread_mutex_lock(&(tex->lock));
-	if (!tex->data) 
+	while (tex->loading)
+		pthread_cond_wait(&(tex->cond), &(tex->lock));
+	if (!tex->data) {
 		fail = load_texture_from_file(tex, filename, mxlvl);
+		tex->reloadfn = reload_image_data;
+	}
 	pthread_mutex_unlock(&(tex->lock));
 
 	if (fail) {
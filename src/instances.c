@@ -0,0 +1,263 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL_opengl.h>
+#include <math.h>
+#include <stdlib.h>
+#include "drawtk.h"
+#include "shapes.h"
+#include "batch.h"
+#include "shader.h"
+#include "texmanager.h"
+
+struct dtk_instances
+{
+	struct dtk_shape* model;
+	unsigned int num;
+
+	// Per-instance {x, y, cos(rot), sin(rot)} followed by the colors
+	GLfloat* data;
+	GLuint vbo;
+	bool dirty;
+
+	// Copies of the model used if hardware instancing is not supported
+	struct dtk_batch batch;
+	unsigned int stamp;
+	bool baked;
+};
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Internal functions                           *
+ *                                                                       *
+ *************************************************************************/
+/* Draw all instances in one call using a vertex shader fetching the
+ * instance data with an attribute divisor. Returns -1 if the context does
+ * not support it.
+ */
+static
+int draw_instances_hw(struct dtk_instances* inst,
+                       struct single_shape* sinshp)
+{
+	const GLvoid* ind;
+	const GLvoid* coloff = (const GLvoid*)(4*inst->num*sizeof(GLfloat));
+	GLuint prog;
+	bool usevbo;
+
+	// Textures drawn with their own program use the CPU path
+	if (uses_texture_program(sinshp->tex)
+	    || !(prog = get_shader_program(DTK_PROG_INSTANCES)))
+		return -1;
+
+	if (!inst->vbo) {
+		glGenBuffers(1, &inst->vbo);
+		if (!inst->vbo)
+			return -1;
+		inst->dirty = true;
+	}
+
+	usevbo = bind_single_shape(sinshp, &ind);
+
+	glBindBuffer(GL_ARRAY_BUFFER, inst->vbo);
+	if (inst->dirty) {
+		glBufferData(GL_ARRAY_BUFFER, 8*inst->num*sizeof(GLfloat),
+		             inst->data, GL_DYNAMIC_DRAW);
+		inst->dirty = false;
+	}
+	glVertexAttribPointer(DTK_ATTRIB_INST_XFORM, 4, GL_FLOAT,
+	                      GL_FALSE, 0, (const GLvoid*)0);
+	glVertexAttribPointer(DTK_ATTRIB_INST_COLOR, 4, GL_FLOAT,
+	                      GL_FALSE, 0, coloff);
+	glVertexAttribDivisorARB(DTK_ATTRIB_INST_XFORM, 1);
+	glVertexAttribDivisorARB(DTK_ATTRIB_INST_COLOR, 1);
+	glEnableVertexAttribArray(DTK_ATTRIB_INST_XFORM);
+	glEnableVertexAttribArray(DTK_ATTRIB_INST_COLOR);
+
+	glUseProgram(prog);
+	glDrawElementsInstancedARB(sinshp->primtype, sinshp->num_ind,
+	                           GL_UNSIGNED_INT, ind, inst->num);
+	glUseProgram(0);
+
+	glDisableVertexAttribArray(DTK_ATTRIB_INST_XFORM);
+	glDisableVertexAttribArray(DTK_ATTRIB_INST_COLOR);
+	glVertexAttribDivisorARB(DTK_ATTRIB_INST_XFORM, 0);
+	glVertexAttribDivisorARB(DTK_ATTRIB_INST_COLOR, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	unbind_single_shape(sinshp, usevbo);
+
+	return 0;
+}
+
+
+/* Expand the instances on the CPU into a batch, rebuilt only when the
+ * instances or the model have been modified.
+ */
+static
+void draw_instances_cpu(struct dtk_instances* inst,
+                        struct single_shape* sinshp)
+{
+	const GLfloat *xf, *color;
+	float xform[6];
+	unsigned int i;
+
+	// Model data in user memory can change without notification
+	if (!sinshp->isalloc && sinshp->usage == DTK_STREAM_DRAW)
+		inst->baked = false;
+
+	if (!inst->baked || inst->stamp != inst->model->stamp) {
+		inst->baked = false;
+		clear_batch(&inst->batch);
+		for (i=0; i<inst->num; i++) {
+			xf = inst->data + 4*i;
+			color = inst->data + 4*(inst->num + i);
+			xform[0] = xf[2];
+			xform[1] = xf[3];
+			xform[2] = -xf[3];
+			xform[3] = xf[2];
+			xform[4] = xf[0];
+			xform[5] = xf[1];
+			if (batch_add_leaf(&inst->batch, sinshp, xform, color)) {
+				clear_batch(&inst->batch);
+				return;
+			}
+		}
+		inst->stamp = inst->model->stamp;
+		inst->baked = true;
+	}
+
+	draw_batch(&inst->batch);
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                        Instances API functions                        *
+ *                                                                       *
+ *************************************************************************/
+API_EXPORTED
+dtk_hinstances dtk_create_instances(dtk_hshape model, unsigned int num)
+{
+	struct dtk_instances* inst;
+	unsigned int i;
+
+	if (!get_single_shape(model) || !num)
+		return NULL;
+
+	inst = calloc(1, sizeof(*inst));
+	if (!inst)
+		return NULL;
+
+	inst->data = malloc(8*num*sizeof(*inst->data));
+	if (!inst->data) {
+		free(inst);
+		return NULL;
+	}
+
+	// Instances are initially at the origin, not rotated and white
+	for (i=0; i<num; i++) {
+		inst->data[4*i] = inst->data[4*i+1] = 0.0f;
+		inst->data[4*i+2] = 1.0f;
+		inst->data[4*i+3] = 0.0f;
+	}
+	for (i=4*num; i<8*num; i++)
+		inst->data[i] = 1.0f;
+
+	inst->model = model;
+	inst->num = num;
+	inst->dirty = true;
+	init_batch(&inst->batch);
+
+	return inst;
+}
+
+
+API_EXPORTED
+int dtk_set_instances(dtk_hinstances inst, unsigned int first,
+                      unsigned int num, const float* pos,
+                      const float* rot, const float* colors)
+{
+	unsigned int i;
+	GLfloat *xf, *col;
+	double angle;
+
+	if (!inst || first > inst->num || num > inst->num - first)
+		return -1;
+
+	for (i=0; i<num; i++) {
+		xf = inst->data + 4*(first+i);
+		col = inst->data + 4*(inst->num+first+i);
+		if (pos) {
+			xf[0] = pos[2*i];
+			xf[1] = pos[2*i+1];
+		}
+		if (rot) {
+			angle = rot[i]*M_PI/180.0;
+			xf[2] = cos(angle);
+			xf[3] = sin(angle);
+		}
+		if (colors) {
+			col[0] = colors[4*i];
+			col[1] = colors[4*i+1];
+			col[2] = colors[4*i+2];
+			col[3] = colors[4*i+3];
+		}
+	}
+
+	inst->dirty = true;
+	inst->baked = false;
+	return 0;
+}
+
+
+API_EXPORTED
+void dtk_draw_instances(dtk_hinstances inst)
+{
+	struct single_shape* sinshp;
+
+	if (!inst)
+		return;
+
+	// The model may have been recreated as a composite shape. Nothing to
+	// draw either while its texture is not ready
+	sinshp = get_single_shape(inst->model);
+	if (!sinshp || !texture_drawable(sinshp->tex))
+		return;
+
+	if (draw_instances_hw(inst, sinshp))
+		draw_instances_cpu(inst, sinshp);
+}
+
+
+API_EXPORTED
+void dtk_destroy_instances(dtk_hinstances inst)
+{
+	if (!inst)
+		return;
+
+	if (inst->vbo)
+		glDeleteBuffers(1, &inst->vbo);
+	free_batch(&inst->batch);
+	free(inst->data);
+	free(inst);
+}
@@ -0,0 +1,428 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <FreeImage.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# if (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))) \
+     || defined(__clang__)
+#  define USE_AVX2
+#  include <immintrin.h>
+# endif
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define USE_NEON
+# include <arm_neon.h>
+#endif
+
+#include "drawtk.h"
+#include "texmanager.h"
+
+// Reduce a pair of rows into one row of the next level. w is the width of
+// the destination row. Each function returns the number of pixels done.
+typedef unsigned int (*boxfn)(uint8_t* restrict dst,
+                              const uint8_t* restrict r0,
+                              const uint8_t* restrict r1, unsigned int w);
+
+static unsigned int mipmap_mode = DTK_MIPMAP_BOX;
+
+
+/*************************************************************************
+ *                                                                       *
+ *                            Box filter kernels                         *
+ *                                                                       *
+ *************************************************************************/
+#if defined(__SSE2__)
+static
+unsigned int box_8bpp_sse2(uint8_t* restrict dst, const uint8_t* restrict r0,
+                           const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1), two = _mm_set1_epi16(2);
+	__m128i a, b, lo, hi;
+
+	for (x=0; x+8<=w; x+=8) {
+		a = _mm_loadu_si128((const __m128i*)(r0 + 2*x));
+		b = _mm_loadu_si128((const __m128i*)(r1 + 2*x));
+
+		// Vertical sums then sums of adjacent pairs
+		lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+		                   _mm_unpacklo_epi8(b, zero));
+		hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+		                   _mm_unpackhi_epi8(b, zero));
+		lo = _mm_packs_epi32(_mm_madd_epi16(lo, one),
+		                     _mm_madd_epi16(hi, one));
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(lo, lo));
+	}
+
+	return x;
+}
+
+
+static
+unsigned int box_32bpp_sse2(uint8_t* restrict dst, const uint8_t* restrict r0,
+                            const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x;
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+	__m128i a, b, lo, hi;
+
+	for (x=0; x+2<=w; x+=2) {
+		a = _mm_loadu_si128((const __m128i*)(r0 + 8*x));
+		b = _mm_loadu_si128((const __m128i*)(r1 + 8*x));
+
+		// lo holds pixels 0 and 1 and hi pixels 2 and 3 summed
+		// vertically. Add each pixel to its right neighbour
+		lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+		                   _mm_unpacklo_epi8(b, zero));
+		hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+		                   _mm_unpackhi_epi8(b, zero));
+		lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+		hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+		lo = _mm_unpacklo_epi64(lo, hi);
+
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+		_mm_storel_epi64((__m128i*)(dst + 4*x),
+		                 _mm_packus_epi16(lo, lo));
+	}
+
+	return x;
+}
+#endif // __SSE2__
+
+
+#ifdef USE_AVX2
+__attribute__((target("avx2")))
+static
+unsigned int box_32bpp_avx2(uint8_t* restrict dst, const uint8_t* restrict r0,
+                            const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i two = _mm256_set1_epi16(2);
+	__m256i a, b, lo, hi;
+
+	// Same as SSE2 version on each 128-bit lane
+	for (x=0; x+4<=w; x+=4) {
+		a = _mm256_loadu_si256((const __m256i*)(r0 + 8*x));
+		b = _mm256_loadu_si256((const __m256i*)(r1 + 8*x));
+
+		lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+		                      _mm256_unpacklo_epi8(b, zero));
+		hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+		                      _mm256_unpackhi_epi8(b, zero));
+		lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+		hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+		lo = _mm256_unpacklo_epi64(lo, hi);
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		lo = _mm256_packus_epi16(lo, lo);
+		lo = _mm256_permute4x64_epi64(lo, 0x08);
+		_mm_storeu_si128((__m128i*)(dst + 4*x),
+		                 _mm256_castsi256_si128(lo));
+	}
+
+	return x;
+}
+
+
+__attribute__((target("avx2")))
+static
+unsigned int box_8bpp_avx2(uint8_t* restrict dst, const uint8_t* restrict r0,
+                           const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x;
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1), two = _mm256_set1_epi16(2);
+	__m256i a, b, lo, hi;
+
+	for (x=0; x+16<=w; x+=16) {
+		a = _mm256_loadu_si256((const __m256i*)(r0 + 2*x));
+		b = _mm256_loadu_si256((const __m256i*)(r1 + 2*x));
+
+		lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero),
+		                      _mm256_unpacklo_epi8(b, zero));
+		hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero),
+		                      _mm256_unpackhi_epi8(b, zero));
+		lo = _mm256_packs_epi32(_mm256_madd_epi16(lo, one),
+		                        _mm256_madd_epi16(hi, one));
+
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, two), 2);
+		lo = _mm256_packus_epi16(lo, lo);
+		lo = _mm256_permute4x64_epi64(lo, 0x08);
+		_mm_storeu_si128((__m128i*)(dst + x),
+		                 _mm256_castsi256_si128(lo));
+	}
+
+	return x;
+}
+#endif // USE_AVX2
+
+
+#ifdef USE_NEON
+static
+unsigned int box_8bpp_neon(uint8_t* restrict dst, const uint8_t* restrict r0,
+                           const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x;
+	uint16x8_t sum;
+
+	for (x=0; x+8<=w; x+=8) {
+		sum = vpaddlq_u8(vld1q_u8(r0 + 2*x));
+		sum = vpadalq_u8(sum, vld1q_u8(r1 + 2*x));
+		vst1_u8(dst + x, vrshrn_n_u16(sum, 2));
+	}
+
+	return x;
+}
+
+
+static
+unsigned int box_24bpp_neon(uint8_t* restrict dst, const uint8_t* restrict r0,
+                            const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x, c;
+	uint8x16x3_t a, b;
+	uint8x8x3_t out;
+
+	for (x=0; x+8<=w; x+=8) {
+		a = vld3q_u8(r0 + 6*x);
+		b = vld3q_u8(r1 + 6*x);
+		for (c=0; c<3; c++)
+			out.val[c] = vrshrn_n_u16(vpadalq_u8(
+			                     vpaddlq_u8(a.val[c]), b.val[c]), 2);
+		vst3_u8(dst + 3*x, out);
+	}
+
+	return x;
+}
+
+
+static
+unsigned int box_32bpp_neon(uint8_t* restrict dst, const uint8_t* restrict r0,
+                            const uint8_t* restrict r1, unsigned int w)
+{
+	unsigned int x, c;
+	uint8x16x4_t a, b;
+	uint8x8x4_t out;
+
+	for (x=0; x+8<=w; x+=8) {
+		a = vld4q_u8(r0 + 8*x);
+		b = vld4q_u8(r1 + 8*x);
+		for (c=0; c<4; c++)
+			out.val[c] = vrshrn_n_u16(vpadalq_u8(
+			                     vpaddlq_u8(a.val[c]), b.val[c]), 2);
+		vst4_u8(dst + 4*x, out);
+	}
+
+	return x;
+}
+#endif // USE_NEON
+
+
+/* Generic version for 8, 24 and 32 bpp: each byte is a channel */
+static
+void box_bytes(uint8_t* restrict dst, const uint8_t* restrict r0,
+               const uint8_t* restrict r1, unsigned int w,
+               unsigned int nch)
+{
+	unsigned int i, j;
+
+	for (i=0; i<w*nch; i++) {
+		j = (i/nch)*nch + i;
+		dst[i] = (r0[j] + r0[j+nch] + r1[j] + r1[j+nch] + 2) >> 2;
+	}
+}
+
+
+/* 16 bpp version: channels are defined by the bit masks of the texture */
+static
+void box_16bpp(uint8_t* restrict dst, const uint8_t* restrict r0,
+               const uint8_t* restrict r1, unsigned int w,
+               const uint16_t* mask)
+{
+	unsigned int x, c, sh;
+	uint16_t p[4], out, m;
+	uint32_t sum;
+
+	for (x=0; x<w; x++) {
+		memcpy(p, r0 + 4*x, 4);
+		memcpy(p + 2, r1 + 4*x, 4);
+		out = 0;
+		for (c=0; c<4; c++) {
+			if (!(m = mask[c]))
+				continue;
+			for (sh=0; !((m >> sh) & 1); sh++);
+			sum = ((p[0] & m) >> sh) + ((p[1] & m) >> sh)
+			    + ((p[2] & m) >> sh) + ((p[3] & m) >> sh);
+			out |= (((sum + 2) >> 2) << sh) & m;
+		}
+		memcpy(dst + 2*x, &out, 2);
+	}
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                            Mipmap generation                          *
+ *                                                                       *
+ *************************************************************************/
+static
+boxfn select_box_kernel(unsigned int bpp)
+{
+#ifdef USE_AVX2
+	if (__builtin_cpu_supports("avx2")) {
+		if (bpp == 8)
+			return box_8bpp_avx2;
+		if (bpp == 32)
+			return box_32bpp_avx2;
+	}
+#endif
+#if defined(__SSE2__)
+	if (bpp == 8)
+		return box_8bpp_sse2;
+	if (bpp == 32)
+		return box_32bpp_sse2;
+#endif
+#ifdef USE_NEON
+	if (bpp == 8)
+		return box_8bpp_neon;
+	if (bpp == 24)
+		return box_24bpp_neon;
+	if (bpp == 32)
+		return box_32bpp_neon;
+#endif
+	(void)bpp;
+	return NULL;
+}
+
+
+/* Compute each level by averaging the 2x2 blocks of the previous one */
+static
+void compute_box_mipmaps(struct dtk_texture* tex)
+{
+	unsigned int i, y, w, done, nch = tex->bpp/8;
+	const struct mipmapdata *src, *dst;
+	uint8_t* bm = tex->bmdata;
+	uint8_t *out;
+	const uint8_t *r0, *r1;
+	uint16_t mask[4];
+	boxfn kernel = select_box_kernel(tex->bpp);
+
+	mask[0] = tex->rmsk;
+	mask[1] = tex->gmsk;
+	mask[2] = tex->bmsk;
+	mask[3] = ~(tex->rmsk | tex->gmsk | tex->bmsk);
+
+	for (i=1; i<=tex->mxlvl; i++) {
+		src = tex->data + i-1;
+		dst = tex->data + i;
+		w = dst->w;
+		for (y=0; y<dst->h; y++) {
+			out = bm + dst->offset + y*dst->stride;
+			r0 = bm + src->offset + 2*y*src->stride;
+			r1 = r0 + src->stride;
+
+			if (tex->bpp == 16) {
+				box_16bpp(out, r0, r1, w, mask);
+				continue;
+			}
+
+			// Remaining pixels are done by the generic version
+			done = kernel ? kernel(out, r0, r1, w) : 0;
+			box_bytes(out + done*nch, r0 + 2*done*nch,
+			          r1 + 2*done*nch, w - done, nch);
+		}
+	}
+}
+
+
+/* Compute the levels with FreeImage bicubic filter */
+static
+void compute_bicubic_mipmaps(struct dtk_texture* tex)
+{
+	FIBITMAP *dib, *dib2;
+	unsigned int i;
+	BYTE* bm = tex->bmdata;
+	
+	dib = FreeImage_ConvertFromRawBits(bm + tex->data[0].offset, 
+	                tex->data[0].w, tex->data[0].h,
+			tex->data[0].stride, tex->bpp,
+			tex->rmsk, tex->gmsk, tex->bmsk, FALSE);
+	
+	for (i=1; i<=tex->mxlvl; i++) {
+		dib2 = FreeImage_Rescale(dib, 
+				tex->data[i].w, tex->data[i].h,
+				FILTER_BICUBIC);
+		FreeImage_ConvertToRawBits(bm + tex->data[i].offset, dib2,
+				tex->data[i].stride, tex->bpp,
+				tex->rmsk, tex->gmsk, tex->bmsk, FALSE);
+		FreeImage_Unload(dib2);
+	}
+	FreeImage_Unload(dib);
+}
+
+
+/* Compute the mipmaps for level 1 until level tex->mxlvl. This function
+ * assume that image data for all mipmaps has already been allocated.
+ * This function assumes that when called, tex->lock is hold
+ */
+LOCAL_FN
+void compute_mipmaps(struct dtk_texture* tex)
+{
+	tex->glmipmap = false;
+	if (!tex->mxlvl)
+		return;
+
+	switch (mipmap_mode) {
+	case DTK_MIPMAP_GL:
+		// Generated by the GL after the upload of level 0
+		tex->glmipmap = true;
+		break;
+
+	case DTK_MIPMAP_BICUBIC:
+		compute_bicubic_mipmaps(tex);
+		break;
+
+	default:
+		compute_box_mipmaps(tex);
+		break;
+	}
+}
+
+
+API_EXPORTED
+int dtk_set_mipmap_mode(unsigned int mode)
+{
+	if (mode > DTK_MIPMAP_GL)
+		return -1;
+
+	mipmap_mode = mode;
+	return 0;
+}
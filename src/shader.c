@@ -0,0 +1,278 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define GL_GLEXT_PROTOTYPES
+#include <SDL_opengl.h>
+#include <stdio.h>
+#include <string.h>
+#include "shader.h"
+
+struct program_desc {
+	const char* vsrc;
+	const char* fsrc;
+	const char* exts[3];
+	const char* attribs[2];
+	GLuint attriblocs[2];
+	const char* samplers[3];
+};
+
+/* Vertex shader applying to the model vertices the per-instance transform
+ * {x, y, cos(rot), sin(rot)} and color. The fragments are processed by the
+ * fixed pipeline. */
+static const char instances_vsrc[] =
+"#version 120\n"
+"attribute vec4 inst_xform;\n"
+"attribute vec4 inst_color;\n"
+"void main()\n"
+"{\n"
+"	vec2 v = gl_Vertex.xy;\n"
+"	vec2 p = vec2(inst_xform.z*v.x - inst_xform.w*v.y,\n"
+"	              inst_xform.w*v.x + inst_xform.z*v.y) + inst_xform.xy;\n"
+"	gl_Position = gl_ModelViewProjectionMatrix * vec4(p, 0.0, 1.0);\n"
+"	gl_FrontColor = gl_Color * inst_color;\n"
+"	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+"}\n";
+
+/* Fragment shaders converting video frames from YUV (BT.601, limited
+ * range) to RGB. The luma plane is bound to the first texture unit, the
+ * chroma planes to the next ones. */
+#define YUV_FSRC(fetch_uv)						\
+"#version 110\n"							\
+"uniform sampler2D ytex, utex, vtex;\n"				\
+"void main()\n"								\
+"{\n"									\
+"	vec2 tc = gl_TexCoord[0].st;\n"				\
+"	float y = 1.1644 * (texture2D(ytex, tc).r - 0.0627);\n"	\
+	fetch_uv							\
+"	vec3 rgb = vec3(y + 1.5960*v,\n"				\
+"	                y - 0.3918*u - 0.8130*v,\n"			\
+"	                y + 2.0172*u);\n"				\
+"	gl_FragColor = gl_Color * vec4(rgb, 1.0);\n"			\
+"}\n"
+
+static const char i420_fsrc[] = YUV_FSRC(
+"	float u = texture2D(utex, tc).r - 0.5;\n"
+"	float v = texture2D(vtex, tc).r - 0.5;\n"
+);
+
+// NV12 chroma is interleaved in a luminance-alpha texture
+static const char nv12_fsrc[] = YUV_FSRC(
+"	float u = texture2D(utex, tc).r - 0.5;\n"
+"	float v = texture2D(utex, tc).a - 0.5;\n"
+);
+
+/* Fragment shader drawing glyphs from a signed distance field stored in
+ * the alpha channel (0.5 on the outlines). The edges are smoothed over
+ * about one pixel whatever the scale, using the screen-space derivatives
+ * of the distance. */
+static const char sdf_fsrc[] =
+"#version 110\n"
+"uniform sampler2D sdftex;\n"
+"void main()\n"
+"{\n"
+"	float d = texture2D(sdftex, gl_TexCoord[0].st).a;\n"
+"	float w = 0.7 * fwidth(d);\n"
+"	float a = smoothstep(0.5 - w, 0.5 + w, d);\n"
+"	gl_FragColor = vec4(gl_Color.rgb, gl_Color.a * a);\n"
+"}\n";
+
+static const struct program_desc progdesc[DTK_NUM_PROG] = {
+	[DTK_PROG_INSTANCES] = {
+		.vsrc = instances_vsrc,
+		.fsrc = NULL,
+		.exts = {"GL_ARB_instanced_arrays", "GL_ARB_draw_instanced"},
+		.attribs = {"inst_xform", "inst_color"},
+		.attriblocs = {DTK_ATTRIB_INST_XFORM, DTK_ATTRIB_INST_COLOR},
+	},
+	[DTK_PROG_I420] = {
+		.vsrc = NULL,
+		.fsrc = i420_fsrc,
+		.samplers = {"ytex", "utex", "vtex"},
+	},
+	[DTK_PROG_NV12] = {
+		.vsrc = NULL,
+		.fsrc = nv12_fsrc,
+		.samplers = {"ytex", "utex"},
+	},
+	[DTK_PROG_SDF] = {
+		.vsrc = NULL,
+		.fsrc = sdf_fsrc,
+		.samplers = {"sdftex"},
+	},
+};
+
+// 0: not built yet, -1: not supported by the context
+static GLint progid[DTK_NUM_PROG];
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Internal functions                           *
+ *                                                                       *
+ *************************************************************************/
+static
+GLuint compile_shader(GLenum type, const char* src)
+{
+	GLuint shader;
+	GLint status;
+	char log[512];
+
+	shader = glCreateShader(type);
+	if (!shader)
+		return 0;
+
+	glShaderSource(shader, 1, &src, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE) {
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "drawtk: shader compilation failed: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	return shader;
+}
+
+
+static
+GLuint build_program(const struct program_desc* desc)
+{
+	GLuint prog, vs = 0, fs = 0;
+	GLint status = GL_FALSE;
+	unsigned int i;
+
+	for (i=0; i<sizeof(desc->exts)/sizeof(desc->exts[0]); i++)
+		if (desc->exts[i] && !has_gl_extension(desc->exts[i]))
+			return 0;
+
+	// GLSL is core since OpenGL 2.0
+	if (!has_gl_version(2, 0) || !(prog = glCreateProgram()))
+		return 0;
+
+	// Shaders that are not provided are replaced by the fixed pipeline
+	if (desc->vsrc && (vs = compile_shader(GL_VERTEX_SHADER, desc->vsrc)))
+		glAttachShader(prog, vs);
+	if (desc->fsrc && (fs = compile_shader(GL_FRAGMENT_SHADER, desc->fsrc)))
+		glAttachShader(prog, fs);
+
+	if ((!desc->vsrc || vs) && (!desc->fsrc || fs)) {
+		for (i=0; i<sizeof(desc->attribs)/sizeof(desc->attribs[0]); i++)
+			if (desc->attribs[i])
+				glBindAttribLocation(prog, desc->attriblocs[i],
+				                     desc->attribs[i]);
+		glLinkProgram(prog);
+		glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	}
+
+	// The shaders are freed when the program is deleted
+	if (vs)
+		glDeleteShader(vs);
+	if (fs)
+		glDeleteShader(fs);
+
+	if (status != GL_TRUE) {
+		glDeleteProgram(prog);
+		return 0;
+	}
+
+	// Samplers are bound to consecutive texture units
+	glUseProgram(prog);
+	for (i=0; i<sizeof(desc->samplers)/sizeof(desc->samplers[0]); i++)
+		if (desc->samplers[i])
+			glUniform1i(glGetUniformLocation(prog,
+			                                 desc->samplers[i]), i);
+	glUseProgram(0);
+
+	return prog;
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Shader functions                             *
+ *                                                                       *
+ *************************************************************************/
+LOCAL_FN
+int has_gl_extension(const char* name)
+{
+	const char *exts, *s;
+	size_t len = strlen(name);
+
+	exts = (const char*)glGetString(GL_EXTENSIONS);
+	if (!exts)
+		return 0;
+
+	// Match whole words only
+	for (s = exts; (s = strstr(s, name)) != NULL; s += len) {
+		if ((s == exts || s[-1] == ' ') && (s[len] == ' ' || !s[len]))
+			return 1;
+	}
+
+	return 0;
+}
+
+
+LOCAL_FN
+int has_gl_version(int major, int minor)
+{
+	const char* version = (const char*)glGetString(GL_VERSION);
+	int vmaj, vmin;
+
+	if (!version || sscanf(version, "%d.%d", &vmaj, &vmin) != 2)
+		return 0;
+
+	return (vmaj > major || (vmaj == major && vmin >= minor));
+}
+
+
+/* Returns the program identified by id, building it if necessary, or 0 if
+ * the current context does not support it.
+ */
+LOCAL_FN
+GLuint get_shader_program(enum dtk_program id)
+{
+	GLuint prog;
+
+	if (!progid[id]) {
+		prog = build_program(&progdesc[id]);
+		progid[id] = prog ? (GLint)prog : -1;
+	}
+
+	return (progid[id] > 0) ? (GLuint)progid[id] : 0;
+}
+
+
+/* Delete the programs of the current context. They will be built again
+ * if requested after a new context is created.
+ */
+LOCAL_FN
+void release_shader_programs(void)
+{
+	unsigned int i;
+
+	for (i=0; i<DTK_NUM_PROG; i++) {
+		if (progid[i] > 0)
+			glDeleteProgram(progid[i]);
+		progid[i] = 0;
+	}
+}
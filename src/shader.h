@@ -0,0 +1,42 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SHADER_H
+#define SHADER_H
+
+#include <SDL_opengl.h>
+
+// Programs built on demand for the current context
+enum dtk_program {
+	DTK_PROG_INSTANCES = 0,
+	DTK_PROG_I420,
+	DTK_PROG_NV12,
+	DTK_PROG_SDF,
+	DTK_NUM_PROG
+};
+
+// Generic vertex attribute locations used by the programs
+#define DTK_ATTRIB_INST_XFORM	1
+#define DTK_ATTRIB_INST_COLOR	2
+
+LOCAL_FN int has_gl_extension(const char* name);
+LOCAL_FN int has_gl_version(int major, int minor);
+LOCAL_FN GLuint get_shader_program(enum dtk_program id);
+LOCAL_FN void release_shader_programs(void);
+
+#endif // SHADER_H
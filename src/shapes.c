@@ -20,14 +20,17 @@
 # include <config.h>
 #endif
 
+#define GL_GLEXT_PROTOTYPES
 #include <SDL_opengl.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <math.h>
 #include "drawtk.h"
 #include "shapes.h"
 #include "window.h"
 #include "texmanager.h"
+#include "batch.h"
 
 
 /*************************
@@ -44,25 +47,128 @@
 /*******************
  * Implementations *
  *******************/
-static void draw_single_shape(const struct dtk_shape* shp)
+/* Upload the geometry of the shape into its buffer objects if it has
+ * been modified since the last upload and bind them. The vertex buffer
+ * holds vertices, colors and texture coordinates in that order.
+ * Returns 0 if the buffer objects are bound, -1 otherwise
+ */
+static int upload_single_shape(struct single_shape* sinshp)
 {
-	struct single_shape* sinshp = shp->data;
+	GLsizeiptr vsize, csize, tsize, isize, dsize;
+	GLenum glusage;
+
+	if (!sinshp->vbo[0]) {
+		glGenBuffers(2, sinshp->vbo);
+		if (!sinshp->vbo[0])
+			return -1;
+		sinshp->vbosize[0] = sinshp->vbosize[1] = 0;
+		sinshp->dirty = true;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, sinshp->vbo[0]);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sinshp->vbo[1]);
+	if (!sinshp->dirty)
+		return 0;
+
+	vsize = 2*sinshp->num_vert*sizeof(GLfloat);
+	csize = sinshp->colors ? 4*sinshp->num_vert*sizeof(GLfloat) : 0;
+	tsize = sinshp->texcoords ? 2*sinshp->num_vert*sizeof(GLfloat) : 0;
+	isize = sinshp->num_ind*sizeof(GLuint);
+	dsize = 3*vsize + tsize;
+	glusage = (sinshp->usage == DTK_DYNAMIC_DRAW) ?
+	                             GL_DYNAMIC_DRAW : GL_STATIC_DRAW;
+
+	// Reallocate the buffer storage only when the size has changed
+	if (sinshp->vbosize[0] != dsize) {
+		sinshp->vbosize[0] = dsize;
+		glBufferData(GL_ARRAY_BUFFER, dsize, NULL, glusage);
+	}
+	if (sinshp->vbosize[1] != isize) {
+		sinshp->vbosize[1] = isize;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, isize, NULL, glusage);
+	}
+
+	glBufferSubData(GL_ARRAY_BUFFER, 0, vsize, sinshp->vertices);
+	if (csize)
+		glBufferSubData(GL_ARRAY_BUFFER, vsize,
+		                csize, sinshp->colors);
+	if (tsize)
+		glBufferSubData(GL_ARRAY_BUFFER, 3*vsize,
+		                tsize, sinshp->texcoords);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, isize, sinshp->indices);
+
+	sinshp->dirty = false;
+	return 0;
+}
 
-	glVertexPointer(2, GL_FLOAT, 0, sinshp->vertices);
-	glColorPointer(4, GL_FLOAT, 0, sinshp->colors);
+
+/* Setup the vertex arrays and texture of the shape. The buffer objects are
+ * used unless the data is streamed. *ind receives the pointer to pass to
+ * glDrawElements. Returns true if the buffer objects are bound.
+ */
+LOCAL_FN
+bool bind_single_shape(struct single_shape* sinshp, const GLvoid** ind)
+{
+	const GLvoid *vert, *col, *tc;
+	bool usevbo = false;
+
+	if (sinshp->usage != DTK_STREAM_DRAW && sinshp->vertices
+	    && !upload_single_shape(sinshp)) {
+		usevbo = true;
+		vert = (const GLvoid*)0;
+		col = (const GLvoid*)(2*sinshp->num_vert*sizeof(GLfloat));
+		tc = (const GLvoid*)(6*sinshp->num_vert*sizeof(GLfloat));
+		*ind = (const GLvoid*)0;
+	} else {
+		vert = sinshp->vertices;
+		col = sinshp->colors;
+		tc = sinshp->texcoords;
+		*ind = sinshp->indices;
+	}
+
+	glVertexPointer(2, GL_FLOAT, 0, vert);
+	glColorPointer(4, GL_FLOAT, 0, col);
 	
-	glBindTexture(GL_TEXTURE_2D, get_texture_id(sinshp->tex));
+	bind_texture(sinshp->tex);
 	if (sinshp->texcoords) {
 		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-		glTexCoordPointer(2, GL_FLOAT, 0, sinshp->texcoords);	
+		glTexCoordPointer(2, GL_FLOAT, 0, tc);	
 	}
 
-	// Draw shapes
-	glDrawElements(sinshp->primtype, sinshp->num_ind, 
-	               GL_UNSIGNED_INT, sinshp->indices);
+	return usevbo;
+}
+
 
+LOCAL_FN
+void unbind_single_shape(const struct single_shape* sinshp, bool usevbo)
+{
 	if (sinshp->texcoords)
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	unbind_texture(sinshp->tex);
+
+	if (usevbo) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+
+static void draw_single_shape(const struct dtk_shape* shp)
+{
+	struct single_shape* sinshp = shp->data;
+	const GLvoid *ind;
+	bool usevbo;
+
+	if (!texture_drawable(sinshp->tex))
+		return;
+
+	usevbo = bind_single_shape(sinshp, &ind);
+
+	// Draw shapes
+	glDrawElements(sinshp->primtype, sinshp->num_ind, 
+	               GL_UNSIGNED_INT, ind);
+
+	unbind_single_shape(sinshp, usevbo);
 }
 
 
@@ -81,18 +187,38 @@ static void set_single_color(const struct dtk_shape* shp, const float* color, un
 	for (i=0; i<4*sinshp->num_vert; i+=4)
 		for (j=0; j<numc; j++)
 			sinshp->colors[i+indc[j]] = color[indc[j]];
+
+	sinshp->dirty = true;
 }
 
-static void destroy_single_shape(void* data)
+static int foreach_single_leaf(const struct dtk_shape* shp,
+                               const float* xform, LeafFn fn, void* data)
 {
-	struct single_shape* sinshp = data;
-	if (sinshp == NULL)
-		return;
+	return fn(shp->data, xform, data);
+}
 
+/* Release the buffers of a single shape but not the structure itself,
+ * which can be embedded in the data of another type of shape
+ */
+LOCAL_FN
+void free_single_shape_buffers(struct single_shape* sinshp)
+{
 	if (sinshp->isalloc) {
 		free(sinshp->vertices);
 		free(sinshp->indices);
 	}	
+	if (sinshp->vbo[0])
+		glDeleteBuffers(2, sinshp->vbo);
+}
+
+
+static void destroy_single_shape(void* data)
+{
+	struct single_shape* sinshp = data;
+	if (sinshp == NULL)
+		return;
+
+	free_single_shape_buffers(sinshp);
 	free(sinshp);
 }
 
@@ -161,14 +287,16 @@ static struct dtk_shape* alloc_generic_shape(struct dtk_shape* shp,
 	struct single_shape* sinshp;
 	int is_shp_alloc = 0;
 
-	// Destroy if composite shape
+	// Destroy if composite shape or other type of shape
 	if (shp == NULL) {
 		is_shp_alloc = 1;
 		shp = calloc(1,sizeof(*shp));
 		if (shp == NULL)
 			return NULL;
-	} else if (shp->drawproc != draw_single_shape) 
+	} else if (shp->destroyproc != destroy_single_shape) {
 		shp->destroyproc(shp->data);
+		shp->data = NULL;
+	}
 
 	// Allocate shapes structs if necessary
 	sinshp = alloc_single_shape(shp->data, numvert, numind,
@@ -180,14 +308,25 @@ static struct dtk_shape* alloc_generic_shape(struct dtk_shape* shp,
 	}
 
 	shp->data = sinshp;
-	shp->drawproc = draw_single_shape;
-	shp->setcolorproc = set_single_color;
-	shp->destroyproc = destroy_single_shape;
+	set_single_shape_procs(shp, destroy_single_shape);
 	
 	return shp;
 }
 
 
+/* Make shp drawn as the single shape at the start of its data, which is
+ * destroyed by destroyproc
+ */
+LOCAL_FN
+void set_single_shape_procs(struct dtk_shape* shp, DestroyShapeFn destroyproc)
+{
+	shp->drawproc = draw_single_shape;
+	shp->setcolorproc = set_single_color;
+	shp->destroyproc = destroyproc;
+	shp->leafproc = foreach_single_leaf;
+}
+
+
 LOCAL_FN
 struct dtk_shape* create_generic_shape(struct dtk_shape* shp,
                                                  unsigned int nvert,
@@ -228,6 +367,11 @@ struct dtk_shape* create_generic_shape(struct dtk_shape* shp,
 	sinshp->primtype = primtype;
 	sinshp->tex = tex;
 
+	// Shapes pointing to user memory stream their data by default
+	sinshp->usage = alloc ? DTK_STATIC_DRAW : DTK_STREAM_DRAW;
+	sinshp->dirty = true;
+	shp->stamp++;
+
 	return shp;
 }
                           
@@ -243,17 +387,86 @@ struct composite_shape
 	struct dtk_shape** array;
 	unsigned int num;
 	int free_children;
+
+	// Flattened children (used if frozen)
+	struct dtk_batch bake;
+	unsigned long bakeversion;
+	bool frozen, baked;
 };
 
 
 /*******************
  * implementations *
  *******************/
+static void destroy_composite_shape(void* data);
+
+/* Returns a value that changes each time a descendant of the composite
+ * shape is moved or modified
+ */
+static unsigned long composite_version(const struct composite_shape* compshp)
+{
+	unsigned int i;
+	unsigned long version = 0;
+	const struct dtk_shape* child;
+
+	for (i=0; i<compshp->num; i++) {
+		child = compshp->array[i];
+		version += child->stamp;
+		if (child->destroyproc == destroy_composite_shape)
+			version += composite_version(child->data);
+	}
+
+	return version;
+}
+
+
+static int check_leaf_bakeable(struct single_shape* sinshp,
+                               const float* xform, void* data)
+{
+	(void)xform;
+	(void)data;
+
+	// Data in user memory can change without notification
+	return (!sinshp->isalloc && sinshp->usage == DTK_STREAM_DRAW) ? -1 : 0;
+}
+
+
+/* Update if necessary the flattened version of the children. Returns 0 if
+ * the flattened version can be used for drawing.
+ */
+static int bake_composite_shape(struct composite_shape* compshp)
+{
+	unsigned int i;
+	unsigned long version = composite_version(compshp);
+
+	if (compshp->baked && version == compshp->bakeversion)
+		return 0;
+
+	compshp->baked = false;
+	clear_batch(&compshp->bake);
+	for (i=0; i<compshp->num; i++) {
+		if (foreach_leaf_shape(compshp->array[i], NULL,
+		                       check_leaf_bakeable, NULL)
+		   || batch_add_shape(&compshp->bake, compshp->array[i], NULL))
+			return -1;
+	}
+
+	compshp->bakeversion = version;
+	compshp->baked = true;
+	return 0;
+}
+
+
 static void draw_composite_shape(const struct dtk_shape* shp)
 {
 	unsigned int i;
 	struct composite_shape* compshp = shp->data;
 
+	if (compshp->frozen && !bake_composite_shape(compshp)) {
+		draw_batch(&compshp->bake);
+		return;
+	}
+
 	for(i=0; i<compshp->num; i++)
 		dtk_draw_shape(compshp->array[i]);
 }
@@ -273,6 +486,19 @@ static void set_composite_color(const struct dtk_shape* shp, const float* color,
 
 }
 
+static int foreach_composite_leaf(const struct dtk_shape* shp,
+                                  const float* xform, LeafFn fn, void* data)
+{
+	unsigned int i;
+	struct composite_shape* compshp = shp->data;
+
+	for (i=0; i<compshp->num; i++)
+		if (foreach_leaf_shape(compshp->array[i], xform, fn, data))
+			return -1;
+
+	return 0;
+}
+
 static void destroy_composite_shape(void* data)
 {
 	unsigned int i;
@@ -283,6 +509,7 @@ static void destroy_composite_shape(void* data)
 	for (i=0; i<compshp->num; i++)
 		dtk_destroy_shape(compshp->array[i]);
 
+	free_batch(&compshp->bake);
 	free(compshp->array);
 	free(compshp);
 }
@@ -300,6 +527,10 @@ struct composite_shape* alloc_composite_shape(struct composite_shape* cshp,
 		cshp = calloc(1, sizeof(*cshp));
 		if (cshp == NULL)
 			return NULL;
+		init_batch(&cshp->bake);
+
+		// The bake must draw the children in the same order
+		cshp->bake.ordered = true;
 	}
 
 	if (cshp->num != num_shp) {
@@ -356,7 +587,10 @@ dtk_hshape dtk_create_composite_shape(struct dtk_shape* shp,
 	shp->drawproc = draw_composite_shape;
 	shp->setcolorproc = set_composite_color;
 	shp->destroyproc = destroy_composite_shape;
+	shp->leafproc = foreach_composite_leaf;
 	compshp->free_children = free_children;
+	compshp->baked = false;
+	shp->stamp++;
 
 	// Copy the list of shapes
 	if (num_shp)
@@ -370,6 +604,87 @@ dtk_hshape dtk_create_composite_shape(struct dtk_shape* shp,
  *                       Generic shape functions                         *
  *                                                                       *
  *************************************************************************/
+/* Returns the single shape data of shp or NULL if it is not a single shape */
+LOCAL_FN
+struct single_shape* get_single_shape(const struct dtk_shape* shp)
+{
+	if (!shp || shp->drawproc != draw_single_shape)
+		return NULL;
+
+	return shp->data;
+}
+
+
+/* Mark the shape and all its descendants as modified */
+static
+void touch_shape(struct dtk_shape* shp)
+{
+	unsigned int i;
+	struct composite_shape* compshp;
+
+	shp->stamp++;
+	if (shp->destroyproc != destroy_composite_shape)
+		return;
+
+	compshp = shp->data;
+	for (i=0; i<compshp->num; i++)
+		touch_shape(compshp->array[i]);
+}
+
+
+/* Compute the transform of the shape (rotation followed by the
+ * translation) and combine it with the parent transform if any.
+ */
+LOCAL_FN
+void shape_transform(const struct dtk_shape* shp, const float* parent,
+                     float* xform)
+{
+	float a, b, c, d, tx, ty;
+	float rad = shp->Rot * (float)(M_PI/180.0);
+	float cs = cos(rad), sn = sin(rad);
+
+	if (!parent) {
+		xform[0] = cs;
+		xform[1] = sn;
+		xform[2] = -sn;
+		xform[3] = cs;
+		xform[4] = shp->pos[0];
+		xform[5] = shp->pos[1];
+		return;
+	}
+
+	a = parent[0];
+	b = parent[1];
+	c = parent[2];
+	d = parent[3];
+	tx = parent[4];
+	ty = parent[5];
+	xform[0] = a*cs + c*sn;
+	xform[1] = b*cs + d*sn;
+	xform[2] = -a*sn + c*cs;
+	xform[3] = -b*sn + d*cs;
+	xform[4] = a*shp->pos[0] + c*shp->pos[1] + tx;
+	xform[5] = b*shp->pos[0] + d*shp->pos[1] + ty;
+}
+
+
+/* Call fn on every single shape referenced by shp (shp itself if it is a
+ * single shape) along with the transform that maps the single shape
+ * vertices in the coordinate system of parent.
+ */
+LOCAL_FN
+int foreach_leaf_shape(const struct dtk_shape* shp, const float* parent,
+                       LeafFn fn, void* data)
+{
+	float xform[6];
+
+	if (!shp->leafproc)
+		return 0;
+
+	shape_transform(shp, parent, xform);
+	return shp->leafproc(shp, xform, fn, data);
+}
+
 API_EXPORTED
 void dtk_draw_shape(struct dtk_shape* shp)
 {
@@ -391,6 +706,7 @@ void dtk_move_shape(dtk_hshape shp, float x, float y)
 {
 	shp->pos[0] = x;
 	shp->pos[1] = y;
+	shp->stamp++;
 } 
 
 
@@ -399,6 +715,7 @@ void dtk_relmove_shape(dtk_hshape shp, float dx, float dy)
 {
 	shp->pos[0] += dx;
 	shp->pos[1] += dy;
+	shp->stamp++;
 }
 
 
@@ -406,6 +723,7 @@ API_EXPORTED
 void dtk_rotate_shape(dtk_hshape shp, float deg)
 {
 	shp->Rot = deg;
+	shp->stamp++;
 }
 
 
@@ -413,6 +731,7 @@ API_EXPORTED
 void dtk_relrotate_shape(dtk_hshape shp, float ddeg)
 {
 	shp->Rot += ddeg;
+	shp->stamp++;
 }
 
 
@@ -431,6 +750,49 @@ void dtk_setcolor_shape(dtk_hshape shp, const float* color, unsigned int mask)
 {
 	
 	shp->setcolorproc(shp, color, mask);
+	touch_shape(shp);
+}
+
+
+static
+int set_leaf_usage(struct single_shape* sinshp, const float* xform,
+                   void* data)
+{
+	(void)xform;
+
+	sinshp->usage = *((const unsigned int*)data);
+	sinshp->vbosize[0] = sinshp->vbosize[1] = 0;
+	sinshp->dirty = true;
+	return 0;
+}
+
+
+API_EXPORTED
+int dtk_set_shape_usage(dtk_hshape shp, unsigned int usage)
+{
+	if (!shp || usage > DTK_STREAM_DRAW)
+		return -1;
+
+	touch_shape(shp);
+	return foreach_leaf_shape(shp, NULL, set_leaf_usage, &usage);
+}
+
+
+API_EXPORTED
+int dtk_freeze_shape(dtk_hshape shp, int freeze)
+{
+	struct composite_shape* compshp;
+
+	if (!shp || shp->destroyproc != destroy_composite_shape)
+		return -1;
+
+	compshp = shp->data;
+	compshp->frozen = freeze;
+	if (!freeze) {
+		compshp->baked = false;
+		free_batch(&compshp->bake);
+	}
 
+	return 0;
 }
 
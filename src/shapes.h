@@ -20,11 +20,18 @@
 #define SHAPES_H
 
 #include <GL/gl.h>
+#include <stdbool.h>
+
+struct single_shape;
 
 typedef void (*DrawShapeFn)(const struct dtk_shape* shp);
 typedef void (*SetColorFn)(const struct dtk_shape* shp, 
 		const float* color, unsigned int mask);
 typedef void (*DestroyShapeFn)(void* data);
+typedef int (*LeafFn)(struct single_shape* sinshp,
+                      const float* xform, void* data);
+typedef int (*ForeachLeafFn)(const struct dtk_shape* shp,
+                             const float* xform, LeafFn fn, void* data);
 
 struct dtk_shape
 {
@@ -32,10 +39,14 @@ struct dtk_shape
 	float pos[2];
 	float Rot; // in degrees
 
+	// incremented each time the shape is moved or modified
+	unsigned int stamp;
+
 	// virtual functions
 	DrawShapeFn drawproc;
 	SetColorFn setcolorproc;
 	DestroyShapeFn destroyproc;
+	ForeachLeafFn leafproc;
 
 	// virtual data
 	void* data;
@@ -52,6 +63,12 @@ struct single_shape
 	unsigned int isalloc;
 	GLenum primtype;
 	struct dtk_texture* tex;
+
+	// Buffer objects (vertex data and indices)
+	GLuint vbo[2];
+	GLsizeiptr vbosize[2];
+	unsigned int usage;
+	bool dirty;
 };
 
 
@@ -71,4 +88,24 @@ struct dtk_shape* create_generic_shape(struct dtk_shape* shp,
 						 struct dtk_texture* tex,
 						 unsigned int flags);
 
+/* 2D affine transforms are stored as 6 floats {a, b, c, d, tx, ty} so that
+ * a point (x,y) is mapped to (a*x + c*y + tx, b*x + d*y + ty) */
+LOCAL_FN
+void shape_transform(const struct dtk_shape* shp, const float* parent,
+                     float* xform);
+LOCAL_FN
+int foreach_leaf_shape(const struct dtk_shape* shp, const float* parent,
+                       LeafFn fn, void* data);
+
+LOCAL_FN
+struct single_shape* get_single_shape(const struct dtk_shape* shp);
+LOCAL_FN
+void set_single_shape_procs(struct dtk_shape* shp, DestroyShapeFn destroyproc);
+LOCAL_FN
+void free_single_shape_buffers(struct single_shape* sinshp);
+LOCAL_FN
+bool bind_single_shape(struct single_shape* sinshp, const GLvoid** ind);
+LOCAL_FN
+void unbind_single_shape(const struct single_shape* sinshp, bool usevbo);
+
 #endif // SHAPES_H
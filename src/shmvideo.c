@@ -0,0 +1,206 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dtk_shmvideo.h"
+#include "shmvideo.h"
+
+// Reader of a ring of frames in shared memory written by another process
+struct shm_ring
+{
+	struct dtk_shmv_header* hdr;
+	size_t mapsize;
+	size_t framesize;
+	uint64_t lastread;	// value of head when the last frame was read
+
+	// Geometry of the ring validated at opening. The header can be
+	// rewritten by the producer and must not be trusted afterwards.
+	uint32_t nslots;
+	uint64_t slotstride;
+	uint64_t dataoffset;
+};
+
+
+static
+int check_ring_header(const struct dtk_shmv_header* hdr, size_t size)
+{
+	uint64_t fsize;
+
+	if (size < sizeof(*hdr) || hdr->magic != DTK_SHMV_MAGIC
+	    || hdr->version != DTK_SHMV_VERSION || !hdr->nslots)
+		return -1;
+
+	// The slots must lie in the object (beware of overflows)
+	fsize = dtk_shmv_framesize(hdr->format, hdr->width, hdr->height);
+	if (!fsize || hdr->slotstride < fsize
+	    || hdr->nslots > size / hdr->slotstride
+	    || hdr->dataoffset > size - hdr->nslots*hdr->slotstride
+	    || hdr->dataoffset < sizeof(*hdr)
+	                         + hdr->nslots*sizeof(hdr->slots[0]))
+		return -1;
+
+	return 0;
+}
+
+
+/* Map the ring created by the producer under name and get the format
+ * and size of its frames. Reading starts at the last frame published.
+ */
+LOCAL_FN
+struct shm_ring* open_shm_ring(const char* name, unsigned int* format,
+                               unsigned int* w, unsigned int* h)
+{
+	struct shm_ring* ring;
+	struct dtk_shmv_header *hdr, geom;
+	struct stat st;
+	uint64_t head;
+	int fd;
+
+	// Waiting on the semaphore modifies it: the mapping is writable
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	hdr = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+		return NULL;
+
+	// Validate a copy of the geometry that the producer cannot modify
+	memset(&geom, 0, sizeof(geom));
+	if ((size_t)st.st_size >= sizeof(*hdr))
+		memcpy(&geom, hdr, offsetof(struct dtk_shmv_header, head));
+	if (check_ring_header(&geom, st.st_size)
+	    || !(ring = malloc(sizeof(*ring)))) {
+		munmap(hdr, st.st_size);
+		return NULL;
+	}
+
+	ring->hdr = hdr;
+	ring->mapsize = st.st_size;
+	ring->framesize = dtk_shmv_framesize(geom.format,
+	                                     geom.width, geom.height);
+	ring->nslots = geom.nslots;
+	ring->slotstride = geom.slotstride;
+	ring->dataoffset = geom.dataoffset;
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	ring->lastread = head ? head-1 : 0;
+
+	*format = geom.format;
+	*w = geom.width;
+	*h = geom.height;
+	return ring;
+}
+
+
+LOCAL_FN
+void close_shm_ring(struct shm_ring* ring)
+{
+	if (!ring)
+		return;
+
+	munmap(ring->hdr, ring->mapsize);
+	free(ring);
+}
+
+
+/* Wait at most timeout_ms for a frame not read yet. Returns 1 if there
+ * is one, 0 otherwise.
+ */
+LOCAL_FN
+int wait_shm_frame(struct shm_ring* ring, unsigned int timeout_ms)
+{
+	struct dtk_shmv_header* hdr = ring->hdr;
+	struct timespec ts;
+
+	if (__atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != ring->lastread)
+		return 1;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	while (sem_timedwait(&hdr->newframe, &ts) && errno == EINTR);
+
+	// The posts accumulated while frames were skipped are not needed
+	while (!sem_trywait(&hdr->newframe));
+
+	return __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) != ring->lastread;
+}
+
+
+/* Copy the newest frame in dst (if not NULL) and get its timestamp.
+ * Returns 1 if a frame has been read, 0 if there is no new frame or if
+ * it has been overwritten while being read, in which case it is skipped.
+ */
+LOCAL_FN
+int read_shm_frame(struct shm_ring* ring, void* dst, int64_t* pts)
+{
+	struct dtk_shmv_header* hdr = ring->hdr;
+	struct dtk_shmv_slot* sl;
+	uint64_t head, n, seq;
+	const char* data;
+
+	head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	if (head == ring->lastread)
+		return 0;
+	ring->lastread = head;
+
+	n = head - 1;
+	sl = hdr->slots + (n % ring->nslots);
+	seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE);
+	if (seq != 2*n+2)
+		return 0;
+
+	data = (const char*)hdr + ring->dataoffset
+	       + (n % ring->nslots)*ring->slotstride;
+	*pts = __atomic_load_n(&sl->pts, __ATOMIC_RELAXED);
+	if (dst)
+		memcpy(dst, data, ring->framesize);
+
+	// Valid only if the producer has not started to rewrite the slot
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) == seq;
+}
+
+
+/* Mark all the frames published as read
+ */
+LOCAL_FN
+void skip_shm_frames(struct shm_ring* ring)
+{
+	ring->lastread = __atomic_load_n(&ring->hdr->head, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,35 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SHMVIDEO_H
+#define SHMVIDEO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct shm_ring;
+
+LOCAL_FN struct shm_ring* open_shm_ring(const char* name,
+                                        unsigned int* format,
+                                        unsigned int* w, unsigned int* h);
+LOCAL_FN void close_shm_ring(struct shm_ring* ring);
+LOCAL_FN int wait_shm_frame(struct shm_ring* ring, unsigned int timeout_ms);
+LOCAL_FN int read_shm_frame(struct shm_ring* ring, void* dst, int64_t* pts);
+LOCAL_FN void skip_shm_frames(struct shm_ring* ring);
+
+#endif
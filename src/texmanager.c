@@ -35,19 +35,47 @@
 
 #include "texmanager.h"
 #include "window.h"
+#include "workpool.h"
+#include "shader.h"
+#include "dtk_time.h"
 
 #ifndef MAX_MIPMAP
 #define MAX_MIPMAP	10
 #endif 
 
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#define MAX(a, b)	((a) > (b) ? (a) : (b))
+
+// Initial number of slots of the texture registry (must be a power of 2)
+#define TEXTABLE_MINSIZE	64
+
+// Partial uploads must cover whole blocks of compressed formats
+#define UPLOAD_ROW_ALIGN	4
+
 static void free_texture(struct dtk_texture* tex);
+static void release_slot_ref(struct dtk_texture* tex, struct frame_slot* sl);
 
 // Structure for texture manager
 struct dtk_texture_manager
 {
 	pthread_mutex_t lstlock;
 	unsigned int inuse, isinit;
-	struct dtk_texture* root;
+
+	// Open addressing hash table (linear probing) keyed by descriptor
+	struct dtk_texture** table;
+	unsigned int size, num;
+
+	// Textures being uploaded and bytes per frame allowed (0: no limit)
+	struct dtk_texture* uploads;
+	unsigned int budget, budgetleft;
+
+	// Video memory used by the textures and its limit (0: no limit)
+	size_t gpubytes, membudget;
+	unsigned long frame, evictions, reloads, reloadfails;
+
+	// The texture matrix currently flips and scales the t coordinate
+	bool texflipped;
+	float texscale;
 };
 
 // Global texture manager
@@ -55,7 +83,20 @@ static struct dtk_texture_manager texman = {
 	.lstlock = PTHREAD_MUTEX_INITIALIZER,
 	.inuse = 0,
 	.isinit = 0,
-	.root = NULL,
+	.table = NULL,
+	.size = 0,
+	.num = 0,
+	.uploads = NULL,
+	.budget = 0,
+	.budgetleft = 0,
+	.gpubytes = 0,
+	.membudget = 0,
+	.frame = 0,
+	.evictions = 0,
+	.reloads = 0,
+	.reloadfails = 0,
+	.texflipped = false,
+	.texscale = 1.0f,
 };
 
 /*************************************************************************
@@ -100,17 +141,24 @@ void acquire_texture_manager(void)
 LOCAL_FN
 void release_texture_manager(void)
 {
-	struct dtk_texture *curr_tex, *next_tex;
+	unsigned int i;
+
+	// Terminate pending asynchronous loads
+	stop_workpool();
 
 	pthread_mutex_lock(&texman.lstlock);
 	if (--texman.inuse == 0) {
 		// Destroy all textures
-		curr_tex = texman.root;
-		while (curr_tex) {
-			next_tex = curr_tex->next_tex;
-			free_texture(curr_tex);
-			curr_tex = next_tex;
-		}
+		for (i=0; i<texman.size; i++)
+			if (texman.table[i])
+				free_texture(texman.table[i]);
+		free(texman.table);
+		texman.table = NULL;
+		texman.size = texman.num = 0;
+		texman.uploads = NULL;
+		texman.gpubytes = 0;
+		texman.texflipped = false;
+		texman.texscale = 1.0f;
 		deinit_texman();
 
 	}
@@ -132,6 +180,79 @@ uint32_t djbhash(const char* string)
 }
 
 
+/* Returns the slot holding the texture identified by desc or the empty
+ * slot where it should be inserted. Assume that texman.lstlock is hold and
+ * that the table has at least one empty slot.
+ */
+static
+unsigned int find_texture_slot(const char* desc, uint32_t hash)
+{
+	unsigned int i, mask = texman.size - 1;
+	struct dtk_texture* tex;
+
+	for (i = hash & mask; (tex = texman.table[i]); i = (i+1) & mask) {
+		if (tex->hash == hash && !strcmp(tex->desc, desc))
+			break;
+	}
+
+	return i;
+}
+
+
+/* Reallocate the table with size slots and reinsert the textures.
+ * Assume that texman.lstlock is hold.
+ */
+static
+int resize_texture_table(unsigned int size)
+{
+	struct dtk_texture **oldtable = texman.table, *tex;
+	unsigned int i, j, oldsize = texman.size;
+
+	texman.table = calloc(size, sizeof(*texman.table));
+	if (!texman.table) {
+		texman.table = oldtable;
+		return -1;
+	}
+	texman.size = size;
+
+	for (i=0; i<oldsize; i++) {
+		if (!(tex = oldtable[i]))
+			continue;
+		j = tex->hash & (size-1);
+		while (texman.table[j])
+			j = (j+1) & (size-1);
+		texman.table[j] = tex;
+	}
+
+	free(oldtable);
+	return 0;
+}
+
+
+/* Remove the texture stored in slot i and shift back the following
+ * entries of the cluster so that no probing sequence is broken.
+ * Assume that texman.lstlock is hold.
+ */
+static
+void remove_texture_slot(unsigned int i)
+{
+	unsigned int j, home, mask = texman.size - 1;
+
+	for (j = (i+1) & mask; texman.table[j]; j = (j+1) & mask) {
+		home = texman.table[j]->hash & mask;
+
+		// Keep the entry if its home slot is cyclically in ]i,j]
+		if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		texman.table[i] = texman.table[j];
+		i = j;
+	}
+	texman.table[i] = NULL;
+	texman.num--;
+}
+
+
 /* Get a texture identified by desc. If it exists, it increments its number 
  * of use. Otherwise it creates a minimal structure (init lock, and fill
  * string_id) with the flag tex->init set to 0.
@@ -139,41 +260,47 @@ uint32_t djbhash(const char* string)
 LOCAL_FN
 struct dtk_texture* get_texture(const char *desc)
 {
-	struct dtk_texture *tex, **last;
+	struct dtk_texture *tex = NULL;
 	uint32_t hash = djbhash(desc);
+	unsigned int i;
 
 	pthread_mutex_lock(&texman.lstlock);
 
 	if (!texman.isinit)
 		init_texman();
 
-	// Go through the linked list of textures to search
-	// for existing entry
-	last = &(texman.root);
-	while (*last != NULL) {
-		if (hash == (*last)->hash) 
-			break;	
-		last = &((*last)->next_tex);
-	}
+	// Keep the load factor below 3/4
+	if (4*(texman.num+1) > 3*texman.size
+	   && resize_texture_table(texman.size ? 2*texman.size
+	                                       : TEXTABLE_MINSIZE))
+		goto out;
 
-	if (*last == NULL) {
+	i = find_texture_slot(desc, hash);
+	if (texman.table[i] == NULL) {
 		// Create empty texture
 		tex = malloc(sizeof(*tex));
 		if (tex == NULL)
 			goto out;
 		
 		memset(tex, 0, sizeof(*tex));
+		if (!(tex->desc = strdup(desc))) {
+			free(tex);
+			tex = NULL;
+			goto out;
+		}
 		pthread_mutex_init(&(tex->lock), NULL);
+		pthread_cond_init(&(tex->cond), NULL);
 		tex->hash = hash;
 		tex->aux = NULL;
 		tex->data = NULL;
 		tex->bmdata = NULL;
-		tex->ipbo = -1;
+		tex->front = tex->back = -1;
+		tex->tscale = 1.0f;
 		
-		// append at the end of the list
-		*last = tex;
+		texman.table[i] = tex;
+		texman.num++;
 	} else 
-		tex = *last;
+		tex = texman.table[i];
 	
 	tex->nused++;
 out:
@@ -181,32 +308,46 @@ out:
 	return tex;
 }
 
+/* Remove the texture from the list of textures being uploaded.
+ * Assume that texman.lstlock is hold.
+ */
+static
+void unlink_texture_upload(struct dtk_texture* tex)
+{
+	struct dtk_texture** last;
+
+	for (last = &texman.uploads; *last; last = &((*last)->next_upload)) {
+		if (*last == tex) {
+			*last = tex->next_upload;
+			break;
+		}
+	}
+}
+
+
 /* Ask to remove a texture. This decrement the number of uses of the
  * texture. If that number reaches 0, it is actually removed.
  */
 LOCAL_FN
 void rem_texture(struct dtk_texture* tex)
 {
-	struct dtk_texture **last;
+	unsigned int i;
 	int deltex = 0;
 
 	pthread_mutex_lock(&texman.lstlock);
 
-	// Go through the linked list of textures to search
-	// for existing entry
-	last = &(texman.root);
-	while (*last != NULL) {
-		if (*last == tex) {
-			pthread_mutex_lock(&(tex->lock));
-			if (--tex->nused == 0) {
-				*last = tex->next_tex;
-				deltex = 1;
-			}
-			pthread_mutex_unlock(&(tex->lock));
-			break;
+	// Search the slot of the texture in the table
+	i = texman.size ? find_texture_slot(tex->desc, tex->hash) : 0;
+	if (texman.size && texman.table[i] == tex) {
+		pthread_mutex_lock(&(tex->lock));
+		if (--tex->nused == 0) {
+			remove_texture_slot(i);
+			unlink_texture_upload(tex);
+			if (tex->id)
+				texman.gpubytes -= tex->glsize;
+			deltex = 1;
 		}
-		// jump to the next item
-		last = &((*last)->next_tex);
+		pthread_mutex_unlock(&(tex->lock));
 	}
 
 	pthread_mutex_unlock(&texman.lstlock);
@@ -228,6 +369,11 @@ void rem_texture(struct dtk_texture* tex)
 static
 void free_texture(struct dtk_texture* tex)
 {
+	unsigned int i;
+
+	// Let a pending asynchronous load terminate
+	wait_texture_loaded(tex);
+
         if (tex->destroyfn)
                 tex->destroyfn(tex);
 
@@ -236,21 +382,120 @@ void free_texture(struct dtk_texture* tex)
 		tex->id = 0;
 	}
 
-	if (tex->ipbo >= 0) {
-		glDeleteBuffers(2, tex->pbo);
-		tex->bmdata = NULL;
+	if (tex->planeid[0])
+		glDeleteTextures(tex->nplanes, tex->planeid);
+
+	// Mapped slots are released with their buffer
+	for (i=0; i<DTK_NSLOT; i++) {
+		if (tex->slots[i].ref)
+			release_slot_ref(tex, tex->slots + i);
+		else if (tex->slots[i].pbo)
+			glDeleteBuffers(1, &tex->slots[i].pbo);
+		else
+			free(tex->slots[i].mem);
 	}
 
+	if (tex->uppbo)
+		glDeleteBuffers(1, &tex->uppbo);
+
 	free(tex->bmdata);
 	free(tex->data);
+	free(tex->desc);
 	tex->data = NULL;
 	tex->bmdata = NULL;
 
         pthread_mutex_destroy(&(tex->lock));
+	pthread_cond_destroy(&(tex->cond));
 
         free(tex);
 }
 
+/* Block until the asynchronous load of the texture, if any, terminates
+ * Assume that tex->lock is NOT hold
+ */
+LOCAL_FN
+void wait_texture_loaded(struct dtk_texture* tex)
+{
+	pthread_mutex_lock(&tex->lock);
+	while (tex->loading)
+		pthread_cond_wait(&tex->cond, &tex->lock);
+	pthread_mutex_unlock(&tex->lock);
+}
+
+
+/* Returns the size of the image data of all mipmaps
+ * Assume that tex->data is not NULL
+ */
+LOCAL_FN
+size_t texture_data_size(const struct dtk_texture* tex)
+{
+	const struct mipmapdata* mm = tex->data + tex->mxlvl;
+
+	if (tex->nplanes)
+		mm = tex->planes + tex->nplanes - 1;
+
+	return mm->offset + mm->h*mm->stride;
+}
+
+
+/* Extend the image data of a texture without mipmap to h rows, keeping
+ * its content. The new rows are cleared. The GL texture is recreated
+ * at the new size the next time it is used.
+ * Assume that tex->lock is hold
+ */
+LOCAL_FN
+int grow_image_data(struct dtk_texture* tex, unsigned int h)
+{
+	struct mipmapdata* mm = tex->data;
+	size_t oldsize, size;
+	char* bm;
+
+	if (!mm || tex->mxlvl || tex->isvideo || h < mm->h)
+		return -1;
+
+	oldsize = texture_data_size(tex);
+	size = (size_t)h * mm->stride;
+	if (tex->bmdata) {
+		if (!(bm = realloc(tex->bmdata, size)))
+			return -1;
+		memset(bm + oldsize, 0, size - oldsize);
+		tex->bmdata = bm;
+	}
+	mm->h = h;
+
+	__atomic_store_n(&tex->resized, true, __ATOMIC_RELEASE);
+	return 0;
+}
+
+
+/* Add a region of level 0 to the part of a static texture uploaded again
+ * the next time it is used
+ * Assume that tex->lock is hold
+ */
+LOCAL_FN
+void mark_texture_dirty(struct dtk_texture* tex, unsigned int x,
+                        unsigned int y, unsigned int w, unsigned int h)
+{
+	unsigned int x1, y1;
+
+	if (!w || !h)
+		return;
+
+	if (tex->dirtyw) {
+		x1 = MAX(x+w, tex->dirtyx+tex->dirtyw);
+		y1 = MAX(y+h, tex->dirtyy+tex->dirtyh);
+		x = MIN(x, tex->dirtyx);
+		y = MIN(y, tex->dirtyy);
+		w = x1 - x;
+		h = y1 - y;
+	}
+	tex->dirtyx = x;
+	tex->dirtyy = y;
+	tex->dirtyh = h;
+	__atomic_store_n(&tex->dirtyw, w, __ATOMIC_RELEASE);
+}
+
+
 /* Allocate ressources to hold image data until mipmap level mxlvl. On the
  * fly, it also calculate the size each mipmap. This function assumes that
  * tex->lock is hold when called
@@ -297,6 +542,149 @@ fail:
 }
 
 
+/* Let the GL compute the mipmaps from level 0 of the bound texture. If the
+ * context cannot do it, the texture is restricted to level 0.
+ */
+static
+void generate_gl_mipmaps(struct dtk_texture* tex)
+{
+	if (has_gl_version(3, 0)
+	   || has_gl_extension("GL_ARB_framebuffer_object")) {
+		glGenerateMipmap(GL_TEXTURE_2D);
+	} else {
+		tex->mxlvl = 0;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	}
+}
+
+
+/* Upload the image data not yet in video memory through a pixel buffer
+ * object, the smallest mipmaps first, until the frame budget is exhausted.
+ * Levels are made available as soon as they are complete by lowering the
+ * base level. Returns 1 if the texture is fully resident, 0 otherwise.
+ * Assume that tex->lock is NOT hold
+ */
+static
+int upload_texture_step(struct dtk_texture* tex)
+{
+	struct mipmapdata* mm;
+	unsigned int rows, nrows, size;
+	uintptr_t off;
+	const char* bm = tex->bmdata;
+
+	pthread_mutex_lock(&tex->lock);
+	if (tex->resident || !tex->data) {
+		pthread_mutex_unlock(&tex->lock);
+		return 1;
+	}
+
+	if (!tex->uppbo) {
+		size = texture_data_size(tex);
+		glGenBuffers(1, &tex->uppbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->uppbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL,
+		                                         GL_STREAM_DRAW);
+	} else
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->uppbo);
+	
+	glBindTexture(GL_TEXTURE_2D, tex->id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, DTK_PALIGN);
+	while (tex->uplvl >= 0) {
+		mm = tex->data + tex->uplvl;
+		nrows = mm->h - tex->uprow;
+
+		// Upload what fits in the budget but at least one band of
+		// rows per frame
+		if (texman.budget) {
+			rows = texman.budgetleft / mm->stride;
+			rows -= rows % UPLOAD_ROW_ALIGN;
+			if (!rows && texman.budgetleft == texman.budget)
+				rows = UPLOAD_ROW_ALIGN;
+			if (!rows)
+				break;
+			if (nrows > rows)
+				nrows = rows;
+			size = nrows*mm->stride;
+			texman.budgetleft -= (size < texman.budgetleft) ?
+			                      size : texman.budgetleft;
+		}
+
+		off = mm->offset + tex->uprow*mm->stride;
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, off,
+		                nrows*mm->stride, bm + off);
+		glTexSubImage2D(GL_TEXTURE_2D, tex->uplvl, 0, tex->uprow,
+		                mm->w, nrows, tex->fmt, tex->type,
+		                (const GLvoid*)off);
+
+		tex->uprow += nrows;
+		if (tex->uprow == mm->h) {
+			tex->baselvl = tex->uplvl--;
+			tex->uprow = 0;
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL,
+			                tex->baselvl);
+		}
+	}
+
+	if (tex->uplvl < 0 && tex->glmipmap)
+		generate_gl_mipmaps(tex);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (tex->uplvl < 0) {
+		glDeleteBuffers(1, &tex->uppbo);
+		tex->uppbo = 0;
+		tex->resident = true;
+
+		// Drop the CPU copy if it can be recreated when needed
+		if (texman.membudget && tex->reloadfn) {
+			free(tex->bmdata);
+			tex->bmdata = NULL;
+		}
+	}
+
+	pthread_mutex_unlock(&tex->lock);
+	return tex->resident;
+}
+
+
+/* Create the textures of the chroma planes of a YUV dynamic texture. If
+ * the context cannot convert them to RGB, the texture is switched to
+ * RGBA frames converted on the CPU.
+ * Assume that tex->lock is hold
+ */
+static
+int create_plane_textures(struct dtk_texture* tex)
+{
+	enum dtk_program prog;
+	unsigned int i;
+
+	prog = (tex->nplanes == 2) ? DTK_PROG_I420 : DTK_PROG_NV12;
+	if (!get_shader_program(prog)) {
+		tex->bmdata = malloc(4 * tex->data[0].w * tex->data[0].h);
+		if (!tex->bmdata)
+			return -1;
+		tex->intfmt = tex->fmt = GL_RGBA;
+		tex->cpuconv = true;
+		return 0;
+	}
+
+	glGenTextures(tex->nplanes, tex->planeid);
+	for (i=0; i<tex->nplanes; i++) {
+		glBindTexture(GL_TEXTURE_2D, tex->planeid[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER,GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, tex->planefmt,
+		             tex->planes[i].w, tex->planes[i].h, 0,
+		             tex->planefmt, GL_UNSIGNED_BYTE, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return 0;
+}
+
+
 /* Create the GL texture and load the image data into the video memory
  * Assume that tex->lock is NOT hold
  */
@@ -304,15 +692,33 @@ static
 void create_gl_texture(struct dtk_texture* tex)
 {
 	unsigned int lvl; 
-	char* bm;
-	GLsizeiptr dsize = 0;
+	bool reloaded = false;
 
 	pthread_mutex_lock(&tex->lock);
-	if (!tex->data) {
+	if (!tex->data || tex->reloadfailed) {
 		pthread_mutex_unlock(&tex->lock);
 		return;
 	}
 
+	// Recreate the image data if it has been dropped. A failure is
+	// remembered so that the file is not decoded again at each draw
+	if (!tex->bmdata && !tex->isvideo) {
+		if (!tex->reloadfn || tex->reloadfn(tex)) {
+			__atomic_store_n(&tex->reloadfailed, true,
+			                 __ATOMIC_RELEASE);
+			__atomic_add_fetch(&texman.reloadfails, 1,
+			                   __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&tex->lock);
+			return;
+		}
+		reloaded = true;
+	}
+
+	if (tex->nplanes && !tex->planeid[0] && !tex->cpuconv
+	    && create_plane_textures(tex)) {
+		pthread_mutex_unlock(&tex->lock);
+		return;
+	}
 
 	// creation of the GL texture Object
 	glGenTextures(1,&(tex->id));
@@ -324,79 +730,479 @@ void create_gl_texture(struct dtk_texture* tex)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, tex->mxlvl);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, DTK_PALIGN);
 
-	// Load each mipmap in video memory 
-	bm = tex->bmdata;
+	// Only allocate the storage of each mipmap here. Static textures
+	// are filled by upload_texture_step(), dynamic ones when a frame is
+	// available
 	for (lvl=0; lvl<=tex->mxlvl; lvl++) {
 		glTexImage2D(GL_TEXTURE_2D, lvl, tex->intfmt, 
 		        tex->data[lvl].w, tex->data[lvl].h, 0,
-			tex->fmt, tex->type, bm + tex->data[lvl].offset);
+			tex->fmt, tex->type, NULL);
 	}
-	tex->outdated = false;
 
 	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// The whole image data is uploaded
+	tex->glsize = texture_data_size(tex);
+	tex->tscale = tex->tcheight ? (float)tex->tcheight / tex->data[0].h
+	                            : 1.0f;
+	tex->dirtyw = 0;
+	tex->resized = false;
 	
 	if (tex->isvideo) {
-		glGenBuffers(2, tex->pbo);
-		tex->ipbo = 0;
-		for (lvl=0; lvl<=tex->mxlvl; lvl++)
-			dsize += tex->data[lvl].h * tex->data[lvl].stride;
-	
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->pbo[1]);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, dsize, NULL,
-		                                            GL_STREAM_DRAW);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->pbo[0]);
-		glBufferData(GL_PIXEL_UNPACK_BUFFER, dsize, NULL,
-		                                            GL_STREAM_DRAW);
+		tex->baselvl = 0;
+		tex->resident = true;
+	} else {
+		// Only level 0 is uploaded if the GL computes the mipmaps
+		tex->uplvl = tex->glmipmap ? 0 : tex->mxlvl;
+		tex->uprow = 0;
+		tex->baselvl = tex->mxlvl + 1;
+		tex->resident = false;
+	}
+
+	pthread_mutex_unlock(&tex->lock);
 
-		free(tex->bmdata);
-		tex->bmdata = glMapBuffer(GL_PIXEL_UNPACK_BUFFER,
-		                                             GL_WRITE_ONLY);
-		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	// Continue the upload in the next frames if not drawn again
+	pthread_mutex_lock(&texman.lstlock);
+	texman.gpubytes += tex->glsize;
+	texman.reloads += reloaded ? 1 : 0;
+	if (!tex->isvideo) {
+		tex->next_upload = texman.uploads;
+		texman.uploads = tex;
 	}
+	pthread_mutex_unlock(&texman.lstlock);
+}
+
+
+/* Delete the GL texture of a static texture. It is created again from
+ * the image data the next time it is used.
+ * Assume that texman.lstlock and tex->lock are hold
+ */
+static
+void delete_gl_texture(struct dtk_texture* tex)
+{
+	glDeleteTextures(1, &tex->id);
+	tex->id = 0;
+	tex->resident = false;
+	tex->baselvl = tex->mxlvl + 1;
+	texman.gpubytes -= tex->glsize;
+}
 
+
+/* Replace the GL texture of a texture whose image data has been resized
+ */
+static
+void drop_resized_texture(struct dtk_texture* tex)
+{
+	pthread_mutex_lock(&texman.lstlock);
+	pthread_mutex_lock(&tex->lock);
+	if (tex->id && tex->resized) {
+		unlink_texture_upload(tex);
+		if (tex->uppbo) {
+			glDeleteBuffers(1, &tex->uppbo);
+			tex->uppbo = 0;
+		}
+		delete_gl_texture(tex);
+	}
 	pthread_mutex_unlock(&tex->lock);
+	pthread_mutex_unlock(&texman.lstlock);
 }
 
 
-/* Update the image data in the GL texture
+/* Upload the region of a resident static texture modified since its
+ * upload
  * Assume that tex->lock is NOT hold
  */
 static
-void update_dynamic_texture(struct dtk_texture* tex)
+void upload_texture_region(struct dtk_texture* tex)
 {
-	unsigned int lvl;
-	int cpbo = tex->ipbo;
-	int npbo = (cpbo + 1) % 2;
+	const struct mipmapdata* mm = tex->data;
+	const char* bm;
 
 	pthread_mutex_lock(&tex->lock);
-	
-	if (!tex->outdated) {
-		pthread_mutex_unlock(&tex->lock);
+	if (tex->dirtyw && (bm = tex->bmdata)) {
+		bm += mm->offset + tex->dirtyy*mm->stride
+		      + tex->dirtyx*tex->bpp/CHAR_BIT;
+		glBindTexture(GL_TEXTURE_2D, tex->id);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, DTK_PALIGN);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, mm->w);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, tex->dirtyx, tex->dirtyy,
+		                tex->dirtyw, tex->dirtyh, tex->fmt, tex->type,
+		                bm);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+	__atomic_store_n(&tex->dirtyw, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&tex->lock);
+}
+
+
+/* Order textures from the least recently drawn */
+static
+int cmp_lastused(const void* a, const void* b)
+{
+	const struct dtk_texture* ta = *(struct dtk_texture* const*)a;
+	const struct dtk_texture* tb = *(struct dtk_texture* const*)b;
+
+	if (ta->lastused != tb->lastused)
+		return (ta->lastused < tb->lastused) ? -1 : 1;
+	return 0;
+}
+
+
+/* Delete the GL texture of the least recently drawn textures until the
+ * video memory used fits in the budget. Textures drawn in the current
+ * frame are kept. The candidates are collected in a single scan of the
+ * table and evicted from the oldest.
+ * Assume that texman.lstlock is hold.
+ */
+static
+void evict_textures(void)
+{
+	struct dtk_texture *tex, **lru;
+	unsigned int i, num = 0;
+
+	if (!texman.membudget || texman.gpubytes <= texman.membudget)
+		return;
+
+	if (!(lru = malloc(texman.num*sizeof(*lru))))
 		return;
+
+	// Find the textures that can be recreated
+	for (i=0; i<texman.size; i++) {
+		tex = texman.table[i];
+		if (!tex || !tex->id || !tex->resident || tex->isvideo
+		   || tex->lastused >= texman.frame
+		   || (!tex->bmdata && !tex->reloadfn))
+			continue;
+		lru[num++] = tex;
 	}
+	qsort(lru, num, sizeof(*lru), cmp_lastused);
 
-	// Map the next buffer
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->pbo[npbo]);
-	tex->bmdata = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-	tex->outdated = false;
+	for (i=0; i<num && texman.gpubytes > texman.membudget; i++) {
+		pthread_mutex_lock(&lru[i]->lock);
+		delete_gl_texture(lru[i]);
+		pthread_mutex_unlock(&lru[i]->lock);
+		texman.evictions++;
+	}
 
-	pthread_mutex_unlock(&tex->lock);
+	free(lru);
+}
+
+
+/* Allocate the frame slots of a dynamic texture. The image data already
+ * allocated becomes the memory of the first slot.
+ * Assume that tex->lock is hold and tex->data is not NULL
+ */
+LOCAL_FN
+int init_frame_slots(struct dtk_texture* tex)
+{
+	size_t size = texture_data_size(tex);
+	unsigned int i;
+
+	tex->slots[0].mem = tex->bmdata;
+	tex->bmdata = NULL;
+	for (i=1; i<DTK_NSLOT; i++) {
+		if (!(tex->slots[i].mem = malloc(size)))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/* Atomically move a slot from the state expected (including its
+ * sequence number) to the state st keeping the sequence number
+ */
+static
+bool switch_slot_state(struct frame_slot* sl, unsigned long expected,
+                       unsigned long st)
+{
+	unsigned long desired = (expected & ~DTK_SLOT_MASK) | st;
+
+	return __atomic_compare_exchange_n(&sl->state, &expected, desired,
+	                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+/* Release the external buffer of a slot owned by the calling thread
+ */
+static
+void release_slot_ref(struct dtk_texture* tex, struct frame_slot* sl)
+{
+	if (sl->ref) {
+		tex->releasefn(sl->ref);
+		sl->ref = NULL;
+		sl->mem = NULL;
+	}
+}
+
+
+/* Take a slot for the next frame: a free one or, if the renderer is late,
+ * the oldest frame not displayed yet. Never blocks.
+ */
+LOCAL_FN
+void* get_back_slot(struct dtk_texture* tex)
+{
+	struct frame_slot* sl;
+	unsigned long st, oldest = 0;
+	int i, iold;
+
+	for (;;) {
+		iold = -1;
+		for (i=0; i<DTK_NSLOT; i++) {
+			sl = tex->slots + i;
+			st = __atomic_load_n(&sl->state, __ATOMIC_ACQUIRE);
+			if ((st & DTK_SLOT_MASK) == DTK_SLOT_FREE
+			   && switch_slot_state(sl, st, DTK_SLOT_WRITING))
+				goto acquired;
+
+			if ((st & DTK_SLOT_MASK) == DTK_SLOT_READY
+			   && (iold < 0 || st < oldest)) {
+				iold = i;
+				oldest = st;
+			}
+		}
+
+		if (iold >= 0) {
+			i = iold;
+			sl = tex->slots + i;
+			if (switch_slot_state(sl, oldest, DTK_SLOT_WRITING)) {
+				if (tex->framefn)
+					tex->framefn(tex, DTK_FRAME_DROPPED, 0);
+				goto acquired;
+			}
+		}
+	}
+
+acquired:
+	release_slot_ref(tex, sl);
+	tex->back = i;
+	return sl->mem;
+}
+
+
+/* Queue the frame written in the back slot with its presentation time
+ * (-1 if unknown)
+ */
+LOCAL_FN
+void publish_back_slot(struct dtk_texture* tex, int64_t pts)
+{
+	struct frame_slot* sl = tex->slots + tex->back;
+
+	__atomic_store_n(&sl->pts, pts, __ATOMIC_RELAXED);
+	tex->seq++;
+	__atomic_store_n(&sl->state, (tex->seq << 2) | DTK_SLOT_READY,
+	                 __ATOMIC_RELEASE);
+}
+
+
+/* Queue a frame held in an external buffer. The reference is released
+ * with tex->releasefn once the frame has been uploaded or dropped.
+ */
+LOCAL_FN
+void publish_buffer(struct dtk_texture* tex, int64_t pts,
+                    void* ref, void* data)
+{
+	struct frame_slot* sl;
+
+	get_back_slot(tex);
+	sl = tex->slots + tex->back;
+	sl->ref = ref;
+	sl->mem = data;
+	publish_back_slot(tex, pts);
+}
+
+
+/* Take a ready frame and release it, dropping its external buffer
+ */
+static
+void drop_frame(struct dtk_texture* tex, struct frame_slot* sl,
+                unsigned long st)
+{
+	if (switch_slot_state(sl, st, DTK_SLOT_DISPLAY)) {
+		release_slot_ref(tex, sl);
+		__atomic_store_n(&sl->state, st & ~DTK_SLOT_MASK,
+		                 __ATOMIC_RELEASE);
+		if (tex->framefn)
+			tex->framefn(tex, DTK_FRAME_DROPPED, 0);
+	}
+}
+
+
+/* Choose the frame to display: the ready frame with the latest
+ * presentation time not after target or, if target is negative, the
+ * newest one. The frames queued before the chosen one are dropped.
+ * Returns the presentation time of the displayed frame (-1 if none).
+ * Called only by the rendering thread.
+ */
+LOCAL_FN
+int64_t select_frame(struct dtk_texture* tex, int64_t target)
+{
+	struct frame_slot *sl, *old;
+	unsigned long st, bestst = 0;
+	int64_t pts, bestpts = -1;
+	int i, best = -1;
+
+	for (i=0; i<DTK_NSLOT; i++) {
+		sl = tex->slots + i;
+		st = __atomic_load_n(&sl->state, __ATOMIC_ACQUIRE);
+		if ((st & DTK_SLOT_MASK) != DTK_SLOT_READY)
+			continue;
+		pts = __atomic_load_n(&sl->pts, __ATOMIC_RELAXED);
+
+		// Without target (or timestamp), the newest frame wins
+		if (target < 0 || pts < 0) {
+			if (best < 0 || st > bestst)
+				goto select;
+			continue;
+		}
 
-	// Unmap the current one to perform texture update
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, tex->pbo[cpbo]);
-	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-	tex->ipbo = npbo;
+		// Frames in the future are shown only if nothing is displayed
+		// yet, and then the earliest one
+		if (pts > target) {
+			if (tex->front < 0 && (best < 0 || (bestpts > target
+			                                  && pts < bestpts)))
+				goto select;
+			continue;
+		}
+		if (best < 0 || bestpts > target || pts > bestpts
+		   || (pts == bestpts && st > bestst))
+			goto select;
+		continue;
+
+	select:
+		best = i;
+		bestst = st;
+		bestpts = pts;
+	}
 
+	if (best >= 0 && switch_slot_state(tex->slots+best, bestst,
+	                                   DTK_SLOT_DISPLAY)) {
+		// Release the frame previously displayed
+		if (tex->front >= 0) {
+			old = tex->slots + tex->front;
+			release_slot_ref(tex, old);
+			st = __atomic_load_n(&old->state, __ATOMIC_RELAXED);
+			__atomic_store_n(&old->state, st & ~DTK_SLOT_MASK,
+			                 __ATOMIC_RELEASE);
+		}
+		tex->front = best;
+		tex->frontdirty = true;
+		if (tex->framefn)
+			tex->framefn(tex, DTK_FRAME_PRESENTED, 0);
+
+		// Drop the frames that are older
+		for (i=0; i<DTK_NSLOT; i++) {
+			sl = tex->slots + i;
+			st = __atomic_load_n(&sl->state, __ATOMIC_ACQUIRE);
+			if ((st & DTK_SLOT_MASK) == DTK_SLOT_READY
+			    && st < bestst)
+				drop_frame(tex, sl, st);
+		}
+	}
+
+	if (tex->front < 0)
+		return -1;
+	return __atomic_load_n(&tex->slots[tex->front].pts, __ATOMIC_RELAXED);
+}
+
+
+/* Load a frame of a dynamic texture located at base (offset in the
+ * bound pixel unpack buffer, if any) in the GL textures
+ */
+LOCAL_FN
+void upload_frame(struct dtk_texture* tex, uintptr_t base)
+{
+	const struct mipmapdata* mm;
+	unsigned int lvl, i;
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, DTK_PALIGN);
 	glBindTexture(GL_TEXTURE_2D, tex->id);
-	// Load each mipmap in video memory 
+
+	if (tex->cpuconv) {
+		convert_yuv_frame(tex, (const uint8_t*)base, tex->bmdata);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+		                tex->data[0].w, tex->data[0].h,
+		                GL_RGBA, GL_UNSIGNED_BYTE, tex->bmdata);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return;
+	}
+
 	for (lvl=0; lvl<=tex->mxlvl; lvl++) {
-		glTexSubImage2D(GL_TEXTURE_2D, lvl, 0, 0,
-		        tex->data[lvl].w, tex->data[lvl].h,
-			tex->fmt, tex->type,
-			(const GLvoid*) tex->data[lvl].offset);
+		mm = tex->data + lvl;
+		glTexSubImage2D(GL_TEXTURE_2D, lvl, 0, 0, mm->w, mm->h,
+		                tex->fmt, tex->type,
+		                (const GLvoid*)(base + mm->offset));
+	}
+
+	for (i=0; i<tex->nplanes; i++) {
+		mm = tex->planes + i;
+		glBindTexture(GL_TEXTURE_2D, tex->planeid[i]);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mm->w, mm->h,
+		                tex->planefmt, GL_UNSIGNED_BYTE,
+		                (const GLvoid*)(base + mm->offset));
 	}
 	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 
+/* Update the image data in the GL texture with the frame to display, by
+ * default the newest one. Once uploaded, a slot in client memory is
+ * replaced by a newly mapped PBO so that the producer can write the next
+ * frames while the transfer is performed.
+ * Assume that tex->lock is NOT hold
+ */
+static
+void update_dynamic_texture(struct dtk_texture* tex)
+{
+	struct frame_slot* sl;
+	struct dtk_timespec start, stop;
+	uintptr_t base;
+
+	if (!tex->timed)
+		select_frame(tex, -1);
+
+	if (!tex->frontdirty)
+		return;
+	tex->frontdirty = false;
+	sl = tex->slots + tex->front;
+
+	// Load the frame in video memory (no data if mapping failed)
+	if (sl->mem) {
+		dtk_gettime(&start);
+		base = (uintptr_t)sl->mem;
+		if (sl->pbo) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, sl->pbo);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			base = 0;
+		}
+		upload_frame(tex, base);
+		if (tex->framefn) {
+			dtk_gettime(&stop);
+			tex->framefn(tex, DTK_FRAME_UPLOADED,
+			             dtk_difftime_us(&stop, &start));
+		}
+	}
+
+	// External buffers are not needed once copied by the GL and frames
+	// converted on the CPU must stay readable
+	if (sl->ref) {
+		release_slot_ref(tex, sl);
+		return;
+	}
+	if (tex->cpuconv)
+		return;
+
+	// Replace the slot by a mapped PBO. Orphaning the previous storage
+	// avoids waiting for the end of the transfer.
+	if (!sl->pbo) {
+		glGenBuffers(1, &sl->pbo);
+		free(sl->mem);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, sl->pbo);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, texture_data_size(tex), NULL,
+	                                                   GL_STREAM_DRAW);
+	sl->mem = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 
@@ -415,11 +1221,47 @@ void dtk_texture_getsize(struct dtk_texture* tex, unsigned int* w,
 	if (!tex || !w || !h)
 		return;
 	
+	pthread_mutex_lock(&tex->lock);
 	if (tex->data) {
 		*w = tex->data[0].w;
 		*h = tex->data[0].h;
 	} else
 		*w = *h = 0;
+	pthread_mutex_unlock(&tex->lock);
+}
+
+
+API_EXPORTED
+int dtk_texture_getstate(struct dtk_texture* tex)
+{
+	int state;
+
+	if (!tex)
+		return DTKT_FAILED;
+
+	pthread_mutex_lock(&tex->lock);
+	if (tex->loading)
+		state = DTKT_LOADING;
+	else if (!tex->data || tex->reloadfailed)
+		state = DTKT_FAILED;
+	else
+		state = DTKT_LOADED;
+	if (tex->resident)
+		state |= DTKT_RESIDENT;
+	pthread_mutex_unlock(&tex->lock);
+
+	return state;
+}
+
+
+API_EXPORTED
+int dtk_texture_wait(struct dtk_texture* tex)
+{
+	if (!tex)
+		return -1;
+
+	wait_texture_loaded(tex);
+	return (dtk_texture_getstate(tex) == DTKT_LOADED) ? 0 : -1;
 }
 
 
@@ -429,41 +1271,207 @@ GLuint get_texture_id(struct dtk_texture *tex)
 	if (!tex)
 		return 0;
 
+	tex->lastused = texman.frame;
+	if (tex->id && __atomic_load_n(&tex->resized, __ATOMIC_ACQUIRE))
+		drop_resized_texture(tex);
+
 	if (tex->id == 0) 
 		create_gl_texture(tex);
-	else if (tex->isvideo)
+
+	if (tex->id && tex->isvideo)
 		update_dynamic_texture(tex);
 
-	return tex->id;
+	if (tex->id && !tex->resident && upload_texture_step(tex)) {
+		pthread_mutex_lock(&texman.lstlock);
+		unlink_texture_upload(tex);
+		pthread_mutex_unlock(&texman.lstlock);
+	}
+
+	// Regions modified after the upload (only static textures are
+	// modified in place)
+	if (tex->id && tex->resident
+	   && __atomic_load_n(&tex->dirtyw, __ATOMIC_ACQUIRE))
+		upload_texture_region(tex);
+
+	// The texture cannot be used before one level is complete
+	return (tex->baselvl <= tex->mxlvl) ? tex->id : 0;
+}
+
+
+/* Tell whether shapes using the texture can be drawn, starting or
+ * continuing its upload. Video textures have no image data until the
+ * stream format is known. The other ones cannot be bound before one level
+ * is uploaded, which may take several frames with an upload budget, after
+ * an eviction or when a font atlas grows. Their shapes are skipped
+ * meanwhile rather than drawn untextured.
+ */
+LOCAL_FN
+bool texture_drawable(struct dtk_texture* tex)
+{
+	if (!tex)
+		return true;
+
+	if (tex->isvideo && !__atomic_load_n(&tex->data, __ATOMIC_ACQUIRE))
+		return false;
+
+	if (__atomic_load_n(&tex->reloadfailed, __ATOMIC_ACQUIRE))
+		return false;
+
+	return get_texture_id(tex) != 0;
 }
 
 
-/* Compute the mipmaps for level 1 until level tex->mxlvl. This function
- * assume that image data for all mipmaps has already been allocated.
- * This function assumes that when called, tex->lock is hold
+/* Bind the texture and set the texture matrix so that texture coordinates
+ * have their origin at the bottom left corner of the image whatever the
+ * order in which its rows are stored, and refer to the height tcheight
+ * if set
  */
 LOCAL_FN
-void compute_mipmaps(struct dtk_texture* tex)
+void bind_texture(struct dtk_texture* tex)
 {
-	FIBITMAP *dib, *dib2;
+	bool flip;
+	float tscale;
+	GLuint id, prog;
 	unsigned int i;
-	BYTE* bm = tex->bmdata;
-	
-	dib = FreeImage_ConvertFromRawBits(bm + tex->data[0].offset, 
-	                tex->data[0].w, tex->data[0].h,
-			tex->data[0].stride, tex->bpp,
-			tex->rmsk, tex->gmsk, tex->bmsk, FALSE);
-	
-	for (i=1; i<=tex->mxlvl; i++) {
-		dib2 = FreeImage_Rescale(dib, 
-				tex->data[i].w, tex->data[i].h,
-				FILTER_BICUBIC);
-		FreeImage_ConvertToRawBits(bm + tex->data[i].offset, dib2,
-				tex->data[i].stride, tex->bpp,
-				tex->rmsk, tex->gmsk, tex->bmsk, FALSE);
-		FreeImage_Unload(dib2);
-	}
-	FreeImage_Unload(dib);
+
+	id = get_texture_id(tex);
+	glBindTexture(GL_TEXTURE_2D, id);
+
+	// YUV frames are converted by a fragment program sampling the
+	// chroma planes on the next texture units
+	if (id && tex->planeid[0]) {
+		for (i=0; i<tex->nplanes; i++) {
+			glActiveTexture(GL_TEXTURE1 + i);
+			glBindTexture(GL_TEXTURE_2D, tex->planeid[i]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glUseProgram(get_shader_program(tex->nplanes == 2 ?
+		                           DTK_PROG_I420 : DTK_PROG_NV12));
+	} else if (id && tex->sdf) {
+		// Distance fields are thresholded at the outlines
+		if ((prog = get_shader_program(DTK_PROG_SDF)))
+			glUseProgram(prog);
+		else {
+			glAlphaFunc(GL_GEQUAL, 0.5f);
+			glEnable(GL_ALPHA_TEST);
+			glDisable(GL_BLEND);
+		}
+	}
+
+	flip = tex ? tex->flipped : false;
+	tscale = tex ? tex->tscale : 1.0f;
+	if (flip == texman.texflipped && tscale == texman.texscale)
+		return;
+
+	glMatrixMode(GL_TEXTURE);
+	glLoadIdentity();
+	if (flip) {
+		glTranslatef(0.0f, 1.0f, 0.0f);
+		glScalef(1.0f, -1.0f, 1.0f);
+	}
+	if (tscale != 1.0f)
+		glScalef(1.0f, tscale, 1.0f);
+	glMatrixMode(GL_MODELVIEW);
+	texman.texflipped = flip;
+	texman.texscale = tscale;
+}
+
+
+/* Restore the state modified by bind_texture() for drawing other shapes
+ */
+LOCAL_FN
+void unbind_texture(struct dtk_texture* tex)
+{
+	if (tex && tex->sdf && !get_shader_program(DTK_PROG_SDF)) {
+		glDisable(GL_ALPHA_TEST);
+		glEnable(GL_BLEND);
+	} else if (uses_texture_program(tex))
+		glUseProgram(0);
+}
+
+
+/* Returns true if the texture is drawn with a fragment program (or its
+ * alpha test fallback)
+ */
+LOCAL_FN
+bool uses_texture_program(const struct dtk_texture* tex)
+{
+	return tex && (tex->planeid[0] || tex->sdf);
+}
+
+
+/* Called at the end of each frame: use the remaining budget to continue
+ * the upload of textures and reset it for the next frame. Then evict the
+ * textures exceeding the memory budget.
+ */
+LOCAL_FN
+void process_texture_uploads(void)
+{
+	struct dtk_texture** last;
+
+	pthread_mutex_lock(&texman.lstlock);
+	last = &texman.uploads;
+	while (*last && (!texman.budget || texman.budgetleft)) {
+		if (upload_texture_step(*last))
+			*last = (*last)->next_upload;
+		else
+			last = &((*last)->next_upload);
+	}
+	texman.budgetleft = texman.budget;
+
+	evict_textures();
+	texman.frame++;
+	pthread_mutex_unlock(&texman.lstlock);
+}
+
+
+API_EXPORTED
+void dtk_set_texture_budget(size_t bytes)
+{
+	pthread_mutex_lock(&texman.lstlock);
+	texman.membudget = bytes;
+	pthread_mutex_unlock(&texman.lstlock);
+}
+
+
+API_EXPORTED
+void dtk_texture_getstats(struct dtk_texture_stats* stats)
+{
+	struct dtk_texture* tex;
+	unsigned int i;
+
+	if (!stats)
+		return;
+
+	memset(stats, 0, sizeof(*stats));
+
+	pthread_mutex_lock(&texman.lstlock);
+	for (i=0; i<texman.size; i++) {
+		if (!(tex = texman.table[i]))
+			continue;
+		stats->num_textures++;
+		pthread_mutex_lock(&tex->lock);
+		if (tex->id)
+			stats->num_resident++;
+		if (tex->bmdata && tex->data && !tex->isvideo)
+			stats->cpu_bytes += texture_data_size(tex);
+		pthread_mutex_unlock(&tex->lock);
+	}
+	stats->gpu_bytes = texman.gpubytes;
+	stats->evictions = texman.evictions;
+	stats->reloads = texman.reloads;
+	stats->reload_failures = __atomic_load_n(&texman.reloadfails,
+	                                         __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&texman.lstlock);
+}
+
+
+API_EXPORTED
+void dtk_set_upload_budget(unsigned int bytes)
+{
+	pthread_mutex_lock(&texman.lstlock);
+	texman.budget = texman.budgetleft = bytes;
+	pthread_mutex_unlock(&texman.lstlock);
 }
 
 
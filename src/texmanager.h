@@ -26,9 +26,27 @@
 #include "drawtk.h"
 
 #define DTK_PALIGN	(sizeof(int))
+
+// Number of frame slots of dynamic textures and their states. The state
+// is stored in the low bits of a word whose high bits hold the sequence
+// number of the frame.
+#define DTK_NSLOT		4
+#define DTK_SLOT_FREE		0
+#define DTK_SLOT_WRITING	1
+#define DTK_SLOT_READY		2
+#define DTK_SLOT_DISPLAY	3
+#define DTK_SLOT_MASK		3
 struct dtk_texture;
 
 typedef void (*destroyproc)(struct dtk_texture*);
+typedef int (*reloadproc)(struct dtk_texture*);
+typedef void (*releaseproc)(void*);
+typedef void (*frameproc)(struct dtk_texture*, int, long);
+
+// Events of the frames of dynamic textures reported to framefn
+#define DTK_FRAME_DROPPED	0
+#define DTK_FRAME_PRESENTED	1
+#define DTK_FRAME_UPLOADED	2
 typedef struct dtk_texture* (*createproc)(const char*);
 
 struct mipmapdata {
@@ -36,6 +54,16 @@ struct mipmapdata {
 	unsigned int stride, h, w;
 };
 
+// Frame of a dynamic texture: its data is in client memory, a mapped PBO
+// or an external buffer (ref) released by the texture releasefn
+struct frame_slot {
+	void* mem;
+	GLuint pbo;
+	void* ref;
+	int64_t pts;
+	unsigned long state;
+};
+
 // Structure for textures
 struct dtk_texture
 {
@@ -45,28 +73,93 @@ struct dtk_texture
 	void* bmdata;
 	void *aux;
 
-	// GL Info
-	GLuint pbo[2];
-	int ipbo;
+	// Queue of frames of dynamic textures. The producer fills a free
+	// slot (or recycles the oldest ready one) and marks it ready, the
+	// renderer picks the ready frame to display in front. Slots change
+	// state only by atomic operations on their state word. back, seq
+	// belong to the producer, front, frontdirty, timed to the renderer.
+	struct frame_slot slots[DTK_NSLOT];
+	int back, front;
+	unsigned long seq;
+	bool frontdirty, timed;
+	releaseproc releasefn;
+
+	// Notified when a frame is dropped before display, presented or
+	// uploaded (with the upload duration in us). Called from the
+	// producer and the renderer threads.
+	frameproc framefn;
+
+	// GL Info and size accounted for it in video memory
 	GLuint id;
+	size_t glsize;
+
+	// Staged upload: next level and row to upload, lowest level complete
+	GLuint uppbo;
+	int uplvl;
+	unsigned int uprow, baselvl;
+	bool resident, glmipmap;
+	struct dtk_texture* next_upload;
+
+	// Region of level 0 of a static texture modified since its upload
+	// (empty if dirtyw is 0) and image data resized, requiring a new
+	// GL texture
+	unsigned int dirtyx, dirtyy, dirtyw, dirtyh;
+	bool resized;
+
+	// Height (in pixels) to which the t coordinates refer if it is not
+	// the height of the image (0), e.g. for atlases growing in height.
+	// tscale is the resulting scale of the GL texture.
+	unsigned int tcheight;
+	float tscale;
+
 	GLint intfmt;
 	GLenum fmt, type;
 	unsigned int bpp, rmsk, bmsk, gmsk;
 
 	// Texture usage
 	unsigned int nused;
+
+	// Key in the texture registry
+	char* desc;
 	uint32_t hash;
 
 	// update lock
 	pthread_mutex_t lock;
 
+	// Signaled when an asynchronous load terminates
+	pthread_cond_t cond;
+	bool loading;
+
 	// Destroy function
 	destroyproc destroyfn;
 
-        bool outdated, isvideo;
-
-	// To be used in a linked list
-	struct dtk_texture* next_tex;
+	// Refill bmdata after it has been dropped (NULL if not possible)
+	reloadproc reloadfn;
+	unsigned long lastused;
+
+	// The dropped image data could not be loaded again: the texture
+	// stays in failed state
+	bool reloadfailed;
+
+        bool isvideo;
+
+	// Image rows are stored from top to bottom
+	bool flipped;
+
+	// The alpha channel holds a signed distance field (0.5 on the
+	// outlines), drawn by a fragment program thresholding it or, if the
+	// context cannot run it, by alpha test
+	bool sdf;
+
+	// Chroma planes of YUV dynamic textures, stored after the luma plane
+	// (level 0) in the frame slots, and their GL textures. If the
+	// context cannot run the conversion program, the frames are
+	// converted to RGBA in bmdata before upload (cpuconv).
+	unsigned int nplanes;
+	struct mipmapdata planes[2];
+	GLuint planeid[2];
+	GLenum planefmt;
+	bool cpuconv;
 };
 
 
@@ -78,7 +171,27 @@ int alloc_image_data(struct dtk_texture* tex,
 struct dtk_texture* get_texture(const char *desc);
 void rem_texture(struct dtk_texture* tex);
 
+LOCAL_FN void wait_texture_loaded(struct dtk_texture* tex);
+LOCAL_FN size_t texture_data_size(const struct dtk_texture* tex);
+LOCAL_FN int grow_image_data(struct dtk_texture* tex, unsigned int h);
+LOCAL_FN void mark_texture_dirty(struct dtk_texture* tex,
+                                 unsigned int x, unsigned int y,
+                                 unsigned int w, unsigned int h);
+LOCAL_FN void process_texture_uploads(void);
 LOCAL_FN GLuint get_texture_id(struct dtk_texture* tex);
+LOCAL_FN bool texture_drawable(struct dtk_texture* tex);
+LOCAL_FN void bind_texture(struct dtk_texture* tex);
 LOCAL_FN void compute_mipmaps(struct dtk_texture* tex);
+LOCAL_FN int init_frame_slots(struct dtk_texture* tex);
+LOCAL_FN void* get_back_slot(struct dtk_texture* tex);
+LOCAL_FN void publish_back_slot(struct dtk_texture* tex, int64_t pts);
+LOCAL_FN void publish_buffer(struct dtk_texture* tex, int64_t pts,
+                             void* ref, void* data);
+LOCAL_FN int64_t select_frame(struct dtk_texture* tex, int64_t target);
+LOCAL_FN void upload_frame(struct dtk_texture* tex, uintptr_t base);
+LOCAL_FN void unbind_texture(struct dtk_texture* tex);
+LOCAL_FN bool uses_texture_program(const struct dtk_texture* tex);
+LOCAL_FN void convert_yuv_frame(const struct dtk_texture* tex,
+                                const uint8_t* frame, uint8_t* rgba);
 
 #endif
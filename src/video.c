@@ -36,17 +36,114 @@
 #include <gst/app/gstappsink.h>
 
 #include "vidpipe_creation.h"
+#include "vidindex.h"
 #include "texmanager.h"
+#include "workpool.h"
 #include "dtk_video.h"
+#include "dtk_time.h"
+#include "dtk_shmvideo.h"
+#include "shmvideo.h"
 
 #define DTK_CH_ASYNC	1
 #define DTK_NO_PREROLL	2
 
+// Frame formats accepted by the sink, by order of preference. Planar
+// formats are converted at draw time. Each %s is replaced by the size
+// restriction of the frames.
+#define SINK_CAPS							\
+	"video/x-raw-yuv, format=(fourcc){I420, NV12}%s; "		\
+	"video/x-raw-gray, bpp=(int)8, depth=(int)8%s; "		\
+	"video/x-raw-rgb, bpp=(int)24, red_mask=(int)0xFF0000, "	\
+	"green_mask=(int)0x00FF00, blue_mask=(int)0x0000FF%s"
+
+#define VIDEO_IDLEN	256
+
+// Tolerance on the frame reached by an accurate seek without index
+#define SEEK_TOLERANCE	(100*GST_MSECOND)
+
+// Upper bound of the first bin of the time histograms (in us) and of the
+// intervals between decoded frames accounted
+#define HIST_FIRSTBIN	250
+#define MAX_INTERVAL	1000000
+
+// Default maximal number of clips kept pre-rolled
+#define VIDEO_POOL_DEFSIZE	8
+
+// Period (in ms) at which the reader of a shared-memory ring checks
+// whether it must stop when no frame comes
+#define SHM_POLL_MS	100
+
+#define ROUND_UP_2(x)	(((x)+1) & ~1)
+#define ROUND_UP_4(x)	(((x)+3) & ~3)
+
+// Maximal size of the frames, 0 if not limited
+struct frame_size
+{
+	unsigned int w, h;
+};
+
 struct videoaux
 {
 	GstElement* pipe;
+	struct frame_size maxsize;
 	pthread_mutex_t lock;
+	pthread_cond_t cond;
 	int state;
+
+	// Notified once the texture is ready or has failed
+	dtk_video_readyfn readyfn;
+	void* readydata;
+
+	// Zero-copy mode: the buffers are queued instead of their content
+	bool zerocopy;
+
+	// Frame index of video files and pending accurate seek
+	char* file;
+	struct frame_index* index;
+	bool seekpending;
+	bool seekexact;
+	int64_t seektarget;
+	struct dtk_timespec seekstart;
+	struct dtk_video_seekstats seekstats;
+
+	// Frame statistics, updated atomically from the streaming, bus and
+	// rendering threads. jitter is the lateness of the last frame
+	// dropped by QoS.
+	struct dtk_video_stats stats;
+	struct dtk_timespec lastframe;
+	bool haslastframe;
+	int64_t jitter;
+
+	// Looping and playlist. The next clip of the playlist is pre-rolled
+	// in its own pipeline while the current one plays. The timestamps
+	// of the frames are offset to increase across loops and clips.
+	bool loop;
+	char** playlist;
+	unsigned int nplaylist, plpos, plgen;
+	GstElement* next;
+	GstBuffer* nextframe;
+	char* nextfile;
+	struct frame_index* nextindex;
+	int64_t ptsoffset;
+	int64_t lastend;
+
+	// Jobs running on the worker threads
+	unsigned int njobs;
+	bool closing;
+
+	// Shared-memory source: ring read by shmthread instead of a
+	// pipeline. shmlatency is the age (in us) of the last frame read.
+	struct shm_ring* shm;
+	pthread_t shmthread;
+	bool shmstop;
+	int64_t shmlatency;
+};
+
+
+struct video_job
+{
+	struct dtk_texture* tex;
+	GstElement* pipe;
 };
 
 
@@ -64,6 +161,8 @@ static GstFlowReturn preroll_callback(GstAppSink *sink,  gpointer data);
 static GstFlowReturn newbuffer_uninit_cb(GstAppSink *sink,  gpointer data);
 static GstFlowReturn preroll_uninit_cb(GstAppSink *sink,  gpointer data);
 static void eos_callback(GstAppSink *sink,  gpointer data);
+static void end_of_clip(struct dtk_texture* tex);
+static void segment_done_job(void* arg);
 
 static GstAppSinkCallbacks sink_callbacks = {
 	.eos = eos_callback,
@@ -77,19 +176,47 @@ static GstAppSinkCallbacks sink_uninit_callbacks = {
 	.new_buffer = newbuffer_uninit_cb
 };
 
+// Pool of video files kept paused and pre-rolled. It holds a reference on
+// each texture. Lock order is vpool.lock -> aux->lock and vpool.lock is
+// never hold while calling the texture manager or waiting for a pipeline.
+// A clip being rewound is marked busy: it is not evicted meanwhile, so
+// that the reference of the pool keeps it alive.
+struct pool_entry
+{
+	dtk_htex tex;
+	unsigned long lastused;
+	bool armed;	// pre-rolled and not handed out since
+	bool busy;	// being rewound without vpool.lock
+};
+
+// Size hint of the videos loaded next
+static struct frame_size target_size;
+
+static struct
+{
+	pthread_mutex_t lock;
+	struct pool_entry* clips;
+	unsigned int num, size, maxsize;
+	unsigned long tick;
+	struct dtk_video_poolstats stats;
+} vpool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.maxsize = VIDEO_POOL_DEFSIZE
+};
+
 
 /**************************************************************************
  *                          Pipeline execution                            *
  **************************************************************************/
 static
-int set_pipe_state(struct videoaux* aux, GstState state, int noblock)
+int set_pipe_state(GstElement* pipe, GstState state, int noblock)
 {
 	GstStateChangeReturn ret;
 	GstClockTime timeout = noblock ? 0 : -1;
 
-	ret = gst_element_set_state(aux->pipe, state);
+	ret = gst_element_set_state(pipe, state);
 	if (ret == GST_STATE_CHANGE_ASYNC)
-		ret = gst_element_get_state(aux->pipe, NULL, NULL, timeout);
+		ret = gst_element_get_state(pipe, NULL, NULL, timeout);
 
 	if (ret == GST_STATE_CHANGE_ASYNC)
 		return DTK_CH_ASYNC;
@@ -100,40 +227,324 @@ int set_pipe_state(struct videoaux* aux, GstState state, int noblock)
 }
 
 
+/* Get a reference on the current pipeline: it is replaced by the one of
+ * the next clip when a playlist is set
+ */
 static
-void update_texture_image(GstBuffer* buffer, struct dtk_texture* tex)
+GstElement* ref_pipe(struct videoaux* aux)
 {
-	unsigned char *tdata, *bdata;
-	unsigned int tstride, bstride, h, i;
+	GstElement* pipe;
 
-	// load data into memory (gstreamer is flipped in GL conventions)
-	h = tex->data[0].h;
-	tstride = tex->data[0].stride;
-	bstride = tex->data[0].w*3;
-	bdata = GST_BUFFER_DATA(buffer) + (h-1)*bstride;
+	pthread_mutex_lock(&aux->lock);
+	pipe = gst_object_ref(aux->pipe);
+	pthread_mutex_unlock(&aux->lock);
 
-	pthread_mutex_lock(&(tex->lock));
-	tdata = tex->bmdata;
-	for (i=0; i<h; i++) {
-		memcpy(tdata, bdata, bstride);
-		tdata += tstride;
-		bdata -= bstride;
+	return pipe;
+}
+
+
+/* Stop a pipeline and drop the reference on it
+ */
+static
+void release_pipe(GstElement* pipe)
+{
+	GstBus* bus;
+
+	// No notification must be sent once it is released
+	bus = gst_element_get_bus(pipe);
+	gst_bus_set_sync_handler(bus, NULL, NULL);
+	gst_object_unref(bus);
+
+	gst_element_set_state(pipe, GST_STATE_READY);
+	gst_element_set_state(pipe, GST_STATE_NULL);
+	gst_object_unref(GST_OBJECT(pipe));
+}
+
+
+/* Run fn on a worker thread. The jobs must be done before the texture is
+ * destroyed. Assume that aux->lock is hold.
+ */
+static
+int schedule_job(struct dtk_texture* tex, workfn fn, GstElement* pipe)
+{
+	struct videoaux* aux = tex->aux;
+	struct video_job* job;
+
+	if (aux->closing || !(job = malloc(sizeof(*job))))
+		return -1;
+
+	job->tex = tex;
+	job->pipe = pipe;
+	if (submit_work(fn, job)) {
+		free(job);
+		return -1;
 	}
-	tex->outdated = true;
-	pthread_mutex_unlock(&(tex->lock));
+
+	aux->njobs++;
+	return 0;
 }
 
 
-static 
-void eos_callback(GstAppSink *sink,  gpointer data)
+static
+void end_job(struct video_job* job)
+{
+	struct videoaux* aux = job->tex->aux;
+
+	pthread_mutex_lock(&aux->lock);
+	if (--aux->njobs == 0)
+		pthread_cond_broadcast(&aux->cond);
+	pthread_mutex_unlock(&aux->lock);
+
+	free(job);
+}
+
+
+/* Release the pipeline of a clip that has been replaced. This cannot be
+ * done in its own streaming thread.
+ */
+static
+void teardown_job(void* arg)
+{
+	struct video_job* job = arg;
+
+	release_pipe(job->pipe);
+	end_job(job);
+}
+
+
+static
+void count_stat(unsigned long* counter)
+{
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Count a duration in a histogram: the first bin holds the durations
+ * below HIST_FIRSTBIN us and each next bin durations twice as long.
+ * The last bin holds the longer ones.
+ */
+static
+void count_duration(unsigned long* hist, long us)
+{
+	unsigned int bin = 0;
+
+	while (bin < DTKV_NBINS-1 && us >= ((long)HIST_FIRSTBIN << bin))
+		bin++;
+
+	count_stat(hist + bin);
+}
+
+
+/* Account a frame reaching the sink and the time elapsed since the
+ * previous one. Called in the streaming thread.
+ */
+static
+void count_decoded_frame(struct videoaux* aux)
+{
+	struct dtk_video_stats* st = &aux->stats;
+	struct dtk_timespec now;
+	long interval;
+
+	dtk_gettime(&now);
+	if (aux->haslastframe) {
+		interval = dtk_difftime_us(&now, &aux->lastframe);
+		if (interval < MAX_INTERVAL)
+			count_duration(st->decode_hist, interval);
+	}
+	aux->lastframe = now;
+	aux->haslastframe = true;
+	count_stat(&st->decoded);
+}
+
+
+/* Called by the texture manager on the fate of the queued frames
+ */
+static
+void count_frame_event(struct dtk_texture* tex, int event, long us)
+{
+	struct dtk_video_stats* st = &((struct videoaux*)tex->aux)->stats;
+
+	switch (event) {
+	case DTK_FRAME_DROPPED:
+		count_stat(&st->dropped);
+		break;
+
+	case DTK_FRAME_PRESENTED:
+		count_stat(&st->presented);
+		break;
+
+	case DTK_FRAME_UPLOADED:
+		count_stat(&st->uploaded);
+		count_duration(st->upload_hist, us);
+		break;
+	}
+}
+
+
+/* Measure the latency of an accurate seek when the frame it targets
+ * reaches the sink
+ */
+static
+void check_seek_done(struct videoaux* aux, GstBuffer* buffer)
+{
+	struct dtk_video_seekstats* st = &aux->seekstats;
+	GstClockTime ts = GST_BUFFER_TIMESTAMP(buffer);
+	GstClockTime dur = GST_BUFFER_DURATION(buffer);
+	struct dtk_timespec now;
+	int64_t target;
+	bool reached;
+	long lat;
+
+	if (!__atomic_load_n(&aux->seekpending, __ATOMIC_ACQUIRE)
+	    || !GST_CLOCK_TIME_IS_VALID(ts))
+		return;
+
+	pthread_mutex_lock(&aux->lock);
+	target = aux->seektarget;
+	if (aux->seekexact)
+		reached = ((int64_t)ts == target);
+	else if (GST_CLOCK_TIME_IS_VALID(dur))
+		reached = ((int64_t)ts <= target && target < (int64_t)(ts+dur));
+	else
+		reached = ((int64_t)ts >= target
+		           && (int64_t)ts < target + (int64_t)SEEK_TOLERANCE);
+
+	if (aux->seekpending && reached) {
+		dtk_gettime(&now);
+		lat = dtk_difftime_us(&now, &aux->seekstart);
+		st->mean_us = (st->mean_us*st->num_seeks + lat)
+		              / (st->num_seeks+1);
+		st->num_seeks++;
+		st->last_us = lat;
+		if (lat > st->max_us)
+			st->max_us = lat;
+		aux->seekpending = false;
+	}
+	pthread_mutex_unlock(&aux->lock);
+}
+
+
+/* Record that the texture has become usable (DTKV_READY) or will never be
+ * (DTKV_ERROR). Only the first call has an effect.
+ */
+static
+void notify_video_ready(struct dtk_texture* tex, int flag)
 {
-	dtk_htex tex = data;
 	struct videoaux* aux = tex->aux;
-	(void)sink;
+	dtk_video_readyfn readyfn;
+	void* readydata;
+	int state;
 
 	pthread_mutex_lock(&aux->lock);
-	aux->state |= DTKV_EOS;
+	if (aux->state & (DTKV_READY | DTKV_ERROR)) {
+		pthread_mutex_unlock(&aux->lock);
+		return;
+	}
+	aux->state |= flag;
+	state = aux->state;
+	readyfn = aux->readyfn;
+	readydata = aux->readydata;
+	pthread_cond_broadcast(&aux->cond);
 	pthread_mutex_unlock(&aux->lock);
+
+	if (readyfn)
+		readyfn(tex, state, readydata);
+}
+
+
+/* Called in the thread posting a message on the bus of the pipeline
+ */
+static
+GstBusSyncReply bus_sync_handler(GstBus* bus, GstMessage* msg, gpointer data)
+{
+	struct dtk_texture* tex = data;
+	struct videoaux* aux = tex->aux;
+	(void)bus;
+
+	gint64 jitter;
+
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ERROR:
+		notify_video_ready(tex, DTKV_ERROR);
+		break;
+
+	// Posted by the elements dropping a late buffer
+	case GST_MESSAGE_QOS:
+		gst_message_parse_qos_values(msg, &jitter, NULL, NULL);
+		__atomic_store_n(&aux->jitter, jitter, __ATOMIC_RELAXED);
+		count_stat(&aux->stats.dropped);
+		break;
+
+	case GST_MESSAGE_SEGMENT_DONE:
+		// The looping seek cannot be issued from the streaming thread
+		pthread_mutex_lock(&aux->lock);
+		schedule_job(tex, segment_done_job, NULL);
+		pthread_mutex_unlock(&aux->lock);
+		break;
+
+	default:
+		break;
+	}
+
+	return GST_BUS_PASS;
+}
+
+
+static
+void release_video_buffer(void* buffer)
+{
+	gst_buffer_unref(buffer);
+}
+
+
+/* Queue the buffer as a new frame of the texture without waiting for the
+ * render thread. Takes the ownership of buffer.
+ */
+static
+void update_texture_image(GstBuffer* buffer, struct dtk_texture* tex)
+{
+	struct videoaux* aux = tex->aux;
+	GstClockTime ts = GST_BUFFER_TIMESTAMP(buffer);
+	GstClockTime dur = GST_BUFFER_DURATION(buffer);
+	int64_t pts = -1;
+	void* slot;
+	size_t size;
+
+	check_seek_done(aux, buffer);
+	count_decoded_frame(aux);
+
+	// Keep track of the end of the clip for the next loop or clip
+	if (GST_CLOCK_TIME_IS_VALID(ts)) {
+		pts = ts + __atomic_load_n(&aux->ptsoffset, __ATOMIC_ACQUIRE);
+		if (GST_CLOCK_TIME_IS_VALID(dur))
+			ts += dur;
+		__atomic_store_n(&aux->lastend, (int64_t)ts, __ATOMIC_RELEASE);
+	}
+
+	// Keep a reference until the frame is uploaded or dropped
+	if (aux->zerocopy) {
+		publish_buffer(tex, pts, buffer, GST_BUFFER_DATA(buffer));
+		return;
+	}
+
+	// load data into a free slot: the frame layout is the same. The
+	// slot is missing if its PBO could not be mapped.
+	size = texture_data_size(tex);
+	if (size > GST_BUFFER_SIZE(buffer))
+		size = GST_BUFFER_SIZE(buffer);
+	if ((slot = get_back_slot(tex)))
+		memcpy(slot, GST_BUFFER_DATA(buffer), size);
+	publish_back_slot(tex, pts);
+	gst_buffer_unref(buffer);
+}
+
+
+static 
+void eos_callback(GstAppSink *sink,  gpointer data)
+{
+	(void)sink;
+
+	end_of_clip(data);
 }
 
 
@@ -148,7 +559,6 @@ GstFlowReturn preroll_callback(GstAppSink *sink,  gpointer data)
 
 	buffer = gst_app_sink_pull_preroll(sink);
 	update_texture_image(buffer, tex);
-	gst_buffer_unref(buffer);
 
 	return GST_FLOW_OK;
 }
@@ -162,7 +572,6 @@ GstFlowReturn newbuffer_callback(GstAppSink *sink,  gpointer data)
 
 	buffer = gst_app_sink_pull_buffer(sink);
 	update_texture_image(buffer, tex);
-	gst_buffer_unref(buffer);
 
 	return GST_FLOW_OK;
 }
@@ -182,6 +591,9 @@ int try_alloc_image(GstAppSink *sink, struct dtk_texture* tex)
 	}
 	pthread_mutex_unlock(&tex->lock);
 
+	if (!ret)
+		notify_video_ready(tex, DTKV_READY);
+
 	return ret;
 }
 
@@ -212,8 +624,20 @@ static
 int pipeline_seek(struct videoaux* aux, gint64 pos)
 {
 	int flag = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+	GstElement* pipe;
+	gboolean ret;
+
+	// Within a segment, the end of the clip is reported by SEGMENT_DONE
+	// which triggers the looping
+	pthread_mutex_lock(&aux->lock);
+	if (aux->loop && !aux->nplaylist)
+		flag |= GST_SEEK_FLAG_SEGMENT;
+	pipe = gst_object_ref(aux->pipe);
+	pthread_mutex_unlock(&aux->lock);
 
-	if (!gst_element_seek_simple(aux->pipe, GST_FORMAT_TIME, flag, pos))
+	ret = gst_element_seek_simple(pipe, GST_FORMAT_TIME, flag, pos);
+	gst_object_unref(pipe);
+	if (!ret)
 		return -1;
 
 	pthread_mutex_lock(&aux->lock);
@@ -223,24 +647,93 @@ int pipeline_seek(struct videoaux* aux, gint64 pos)
 }
 
 
+/* Seek to the frame displayed at pos, decoding from the previous keyframe
+ * if needed. The cached index, if available, gives the exact timestamp of
+ * that frame and whether it is a keyframe that can be reached directly.
+ */
+static
+int pipeline_seek_accurate(struct videoaux* aux, gint64 pos)
+{
+	int flag = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+	unsigned int ndecode;
+	int64_t pts;
+	GstElement* pipe;
+	gboolean ret;
+
+	pthread_mutex_lock(&aux->lock);
+
+	// The index may have been built since the file was opened
+	if (!aux->index && aux->file)
+		aux->index = load_frame_index(aux->file);
+
+	aux->seekexact = false;
+	if (aux->index) {
+		find_index_frame(aux->index, pos, &pts, &ndecode);
+		pos = pts;
+		aux->seekexact = true;
+		if (!ndecode)
+			flag = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT;
+	}
+
+	if (aux->loop && !aux->nplaylist)
+		flag |= GST_SEEK_FLAG_SEGMENT;
+
+	aux->seektarget = pos;
+	dtk_gettime(&aux->seekstart);
+	__atomic_store_n(&aux->seekpending, true, __ATOMIC_RELEASE);
+	pipe = gst_object_ref(aux->pipe);
+	pthread_mutex_unlock(&aux->lock);
+
+	ret = gst_element_seek_simple(pipe, GST_FORMAT_TIME, flag, pos);
+	gst_object_unref(pipe);
+	if (!ret) {
+		__atomic_store_n(&aux->seekpending, false, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	pthread_mutex_lock(&aux->lock);
+	aux->state &= ~DTKV_EOS;
+	pthread_mutex_unlock(&aux->lock);
+	return 0;
+}
+
+
 static
 int pipeline_play_pause(struct videoaux* aux, int playing, int noblock)
 {
 	GstState gstate = GST_STATE_PAUSED;
+	GstElement* pipe;
+	int prevstate, ret;
 
 	if (playing)
 		gstate = GST_STATE_PLAYING;
 
-	if (set_pipe_state(aux, gstate, noblock) < 0)
-		return -1;
-
+	// The flag is set first so that a clip switching concurrently
+	// starts in the requested state
 	pthread_mutex_lock(&aux->lock);
+	prevstate = aux->state;
 	if (playing)
 		aux->state |= DTKV_PLAYING;
 	else
 		aux->state &= ~DTKV_PLAYING;
+	pipe = aux->pipe ? gst_object_ref(aux->pipe) : NULL;
 	pthread_mutex_unlock(&aux->lock);
 
+	// Without pipeline, the reader of the source follows the flag
+	if (!pipe)
+		return 0;
+
+	ret = set_pipe_state(pipe, gstate, noblock);
+	gst_object_unref(pipe);
+
+	if (ret < 0) {
+		pthread_mutex_lock(&aux->lock);
+		aux->state &= ~DTKV_PLAYING;
+		aux->state |= prevstate & DTKV_PLAYING;
+		pthread_mutex_unlock(&aux->lock);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -248,12 +741,118 @@ int pipeline_play_pause(struct videoaux* aux, int playing, int noblock)
 /**************************************************************************
  *                           Pipeline creation                            *
  **************************************************************************/
+/* Set the formats accepted by the sink of a pipeline. The frames larger
+ * than maxsize are downscaled by the pipeline, keeping their aspect
+ * ratio. Returns a reference on the sink.
+ */
+static
+GstAppSink* configure_sink(GstElement* pipe, const struct frame_size* maxsize)
+{
+	GstAppSink* sink;
+	GstCaps* caps;
+	char size[64] = "", desc[512];
+
+	if (maxsize->w && maxsize->h)
+		sprintf(size, ", width=(int)[1,%u], height=(int)[1,%u]",
+		        maxsize->w, maxsize->h);
+	snprintf(desc, sizeof(desc), SINK_CAPS, size, size, size);
+
+	sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipe), "dtksink"));
+	caps = gst_caps_from_string(desc);
+	gst_app_sink_set_caps(sink, caps);
+	gst_caps_unref(caps);
+	gst_app_sink_set_max_buffers(sink, 2);
+	gst_app_sink_set_drop(sink, TRUE);
+
+	return sink;
+}
+
+
+/* Describe the chroma planes of a YUV frame as laid out by gstreamer
+ * after the luma plane and extend the image data to the whole frame
+ */
+static
+int alloc_chroma_planes(struct dtk_texture* tex, bool nv12)
+{
+	unsigned int w = tex->data[0].w, h = tex->data[0].h;
+	struct mipmapdata* pl = tex->planes;
+	void* bm;
+
+	pl[0].offset = tex->data[0].stride * ROUND_UP_2(h);
+	pl[0].w = ROUND_UP_2(w) / 2;
+	pl[0].h = ROUND_UP_2(h) / 2;
+	if (nv12) {
+		pl[0].stride = ROUND_UP_4(w);
+		tex->nplanes = 1;
+		tex->planefmt = GL_LUMINANCE_ALPHA;
+	} else {
+		pl[0].stride = ROUND_UP_4(pl[0].w);
+		pl[1] = pl[0];
+		pl[1].offset = pl[0].offset + pl[0].stride*pl[0].h;
+		tex->nplanes = 2;
+		tex->planefmt = GL_LUMINANCE;
+	}
+
+	if (!(bm = realloc(tex->bmdata, texture_data_size(tex))))
+		return -1;
+	tex->bmdata = bm;
+	return 0;
+}
+
+
+/* Allocate the image data of a video texture for frames of size w x h
+ * in one of the DTK_SHMV_* formats
+ */
+static
+int alloc_video_image(struct dtk_texture* tex, unsigned int w,
+                      unsigned int h, unsigned int format)
+{
+	// Allocate image data: the luma of YUV frames is the level 0
+	tex->type = GL_UNSIGNED_BYTE;
+	if (format == DTK_SHMV_RGB) {
+		tex->intfmt = GL_RGB;
+		tex->fmt = GL_RGB;
+		if (alloc_image_data(tex, w, h, 0, 24))
+			return -1;
+	} else {
+		tex->intfmt = GL_LUMINANCE;
+		tex->fmt = GL_LUMINANCE;
+		if (alloc_image_data(tex, w, h, 0, 8))
+			return -1;
+		if (format != DTK_SHMV_GRAY
+		   && alloc_chroma_planes(tex, format == DTK_SHMV_NV12)) {
+			// Allow the allocation to be tried again
+			free(tex->data);
+			tex->data = NULL;
+			return -1;
+		}
+	}
+
+	// The frames are kept as they come from gstreamer, i.e. flipped in
+	// GL conventions
+	tex->flipped = true;
+
+	// In zero-copy mode, they are uploaded from the buffers
+	if (((struct videoaux*)tex->aux)->zerocopy) {
+		free(tex->bmdata);
+		tex->bmdata = NULL;
+		tex->releasefn = release_video_buffer;
+		return 0;
+	}
+
+	return init_frame_slots(tex);
+}
+
+
 static
 int alloc_compatible_image(GstAppSink* sink, struct dtk_texture* tex)
 {
 	int h,w;
+	guint32 fourcc = 0;
+	unsigned int format = DTK_SHMV_GRAY;
 	GstCaps* caps;
 	GstStructure* structure;
+	const char* name;
 
 	// Get negotiated caps (NULL if not negotiated yet)
 	caps = GST_PAD_CAPS(GST_BASE_SINK_PAD(sink));
@@ -264,116 +863,473 @@ int alloc_compatible_image(GstAppSink* sink, struct dtk_texture* tex)
 	structure = gst_caps_get_structure(caps, 0);
 	gst_structure_get_int(structure, "height", &h);
 	gst_structure_get_int(structure, "width", &w);
+	name = gst_structure_get_name(structure);
+	gst_structure_get_fourcc(structure, "format", &fourcc);
 
-	// Allocate image data
-	tex->intfmt = GL_RGB;
-	tex->fmt = GL_RGB;
-	tex->type = GL_UNSIGNED_BYTE;
-	alloc_image_data(tex, w, h, 0, 24);
+	if (!strcmp(name, "video/x-raw-rgb"))
+		format = DTK_SHMV_RGB;
+	else if (!strcmp(name, "video/x-raw-yuv"))
+		format = (fourcc == GST_MAKE_FOURCC('N','V','1','2'))
+		         ? DTK_SHMV_NV12 : DTK_SHMV_I420;
 
-	return 0;
+	return alloc_video_image(tex, w, h, format);
 }
 
 
+/* Tell whether the frames negotiated by the sink have the layout of the
+ * image data of the texture, i.e. whether they can replace its frames
+ */
 static
-void wait_for_data_alloc(struct dtk_texture* tex, int live)
+bool frames_fit_texture(GstAppSink* sink, const struct dtk_texture* tex)
 {
-	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	int h = 0, w = 0;
+	guint32 fourcc = 0;
+	unsigned int bpp = 8, nplanes = 0;
+	GstCaps* caps;
+	GstStructure* structure;
+	const char* name;
 
-	if (live)
-		set_pipe_state(tex->aux, GST_STATE_PLAYING, 0);
+	caps = GST_PAD_CAPS(GST_BASE_SINK_PAD(sink));
+	if (!caps)
+		return false;
 
-	// Wait until the image data has been allocated
-	pthread_mutex_lock(&tex->lock);
-	while (!tex->data)
-		pthread_cond_wait(&cond, &tex->lock);
-	pthread_mutex_unlock(&tex->lock);
-	
-	if (live)
-		set_pipe_state(tex->aux, GST_STATE_PAUSED, 0);
+	structure = gst_caps_get_structure(caps, 0);
+	gst_structure_get_int(structure, "height", &h);
+	gst_structure_get_int(structure, "width", &w);
+	name = gst_structure_get_name(structure);
+	gst_structure_get_fourcc(structure, "format", &fourcc);
+
+	if (!strcmp(name, "video/x-raw-rgb"))
+		bpp = 24;
+	else if (!strcmp(name, "video/x-raw-yuv"))
+		nplanes = (fourcc == GST_MAKE_FOURCC('N','V','1','2')) ? 1 : 2;
 
-	pthread_cond_destroy(&cond);
+	return (w == (int)tex->data[0].w && h == (int)tex->data[0].h
+	        && bpp == tex->bpp && nplanes == tex->nplanes);
 }
 
 
 static
-void destroyPipeline(dtk_htex tex)
+int wait_for_data_alloc(struct dtk_texture* tex, int live)
 {
 	struct videoaux* aux = tex->aux;
+	int state;
 
-	// set pipeline status to dead
-	gst_element_set_state(aux->pipe, GST_STATE_READY);
-	gst_element_set_state(aux->pipe, GST_STATE_NULL);
-	gst_object_unref(GST_OBJECT(aux->pipe));
+	if (live)
+		set_pipe_state(aux->pipe, GST_STATE_PLAYING, 0);
+
+	// Wait until the image data has been allocated or the pipeline
+	// has failed
+	pthread_mutex_lock(&aux->lock);
+	while (!(aux->state & (DTKV_READY | DTKV_ERROR)))
+		pthread_cond_wait(&aux->cond, &aux->lock);
+	state = aux->state;
+	pthread_mutex_unlock(&aux->lock);
 	
-	pthread_mutex_destroy(&aux->lock);
-	free(aux);
-	tex->aux = NULL;
+	if (live)
+		set_pipe_state(aux->pipe, GST_STATE_PAUSED, 0);
+
+	return (state & DTKV_ERROR) ? -1 : 0;
 }
 
 
-// Assume holding tex->lock
+/**************************************************************************
+ *                              Video pool                                *
+ **************************************************************************/
+/* Returns the index in the pool of the clip identified by desc or -1.
+ * Assume that vpool.lock is hold.
+ */
 static
-int init_video_tex(struct dtk_texture* tex, GstElement* pipe, int noblock)
+int pool_find(const char* desc)
 {
-	GstAppSink* sink;
-	GstCaps* caps;
-	struct videoaux* aux;
-	int r, retval = 0;
+	unsigned int i;
 
-	// Configure sink
-	sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipe), "dtksink"));
-	caps = gst_caps_new_simple("video/x-raw-rgb",
-				   "bpp", G_TYPE_INT, 24,
-				   "red_mask", G_TYPE_INT, 0xFF0000,
-				   "green_mask", G_TYPE_INT, 0x00FF00,
-				   "blue_mask", G_TYPE_INT, 0x0000FF, NULL);
-	gst_app_sink_set_caps(sink, caps);
-	gst_caps_unref(caps);
-	gst_app_sink_set_max_buffers(sink, 2);
-	gst_app_sink_set_drop(sink, TRUE);
-	gst_app_sink_set_callbacks(sink, &sink_uninit_callbacks, tex, NULL);
+	for (i=0; i<vpool.num; i++)
+		if (!strcmp(vpool.clips[i].tex->desc, desc))
+			return i;
+
+	return -1;
+}
+
+
+static
+void pool_remove(unsigned int i)
+{
+	vpool.clips[i] = vpool.clips[--vpool.num];
+	vpool.stats.num_clips = vpool.num;
+}
+
+
+/* Remove from the pool the least recently used clips until at most
+ * maxnum remain, skipping those being rewound. The textures whose
+ * reference must be dropped are stored in evicted. Returns their number.
+ * Assume that vpool.lock is hold.
+ */
+static
+unsigned int pool_evict(unsigned int maxnum, dtk_htex* evicted)
+{
+	unsigned int i, n = 0;
+	int lru;
+
+	while (vpool.num > maxnum) {
+		lru = -1;
+		for (i=0; i<vpool.num; i++) {
+			if (vpool.clips[i].busy)
+				continue;
+			if (lru < 0 || vpool.clips[i].lastused
+			                       < vpool.clips[lru].lastused)
+				lru = i;
+		}
+		if (lru < 0)
+			break;
+		evicted[n++] = vpool.clips[lru].tex;
+		pool_remove(lru);
+		vpool.stats.evictions++;
+	}
+
+	return n;
+}
+
+
+static
+void pool_forget(dtk_htex tex)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&vpool.lock);
+	for (i=0; i<vpool.num; i++) {
+		if (vpool.clips[i].tex == tex) {
+			pool_remove(i);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&vpool.lock);
+}
+
+
+/* Record the loading of the clip desc: a hit if it is pre-rolled in the
+ * pool, a miss otherwise. The clip is no longer pre-rolled then.
+ */
+static
+void pool_account_load(const char* desc)
+{
+	int i;
+
+	pthread_mutex_lock(&vpool.lock);
+	i = pool_find(desc);
+	if (i >= 0 && vpool.clips[i].armed) {
+		vpool.clips[i].armed = false;
+		vpool.clips[i].lastused = ++vpool.tick;
+		vpool.stats.hits++;
+	} else
+		vpool.stats.misses++;
+	pthread_mutex_unlock(&vpool.lock);
+}
+
+
+/* Put back a clip of the pool at its start, paused and pre-rolled
+ */
+static
+int rewind_clip(dtk_htex tex)
+{
+	struct videoaux* aux = tex->aux;
+	GstElement* pipe;
+	GstStateChangeReturn ret;
+
+	if (pipeline_play_pause(aux, 0, 0) || pipeline_seek(aux, 0))
+		return -1;
+
+	// Wait for the preroll of the first frame
+	pipe = ref_pipe(aux);
+	ret = gst_element_get_state(pipe, NULL, NULL, GST_CLOCK_TIME_NONE);
+	gst_object_unref(pipe);
+
+	return (ret == GST_STATE_CHANGE_FAILURE) ? -1 : 0;
+}
+
+
+static
+void destroyPipeline(dtk_htex tex)
+{
+	struct videoaux* aux = tex->aux;
+	unsigned int i;
+
+	// Let the running jobs terminate and prevent new ones
+	pthread_mutex_lock(&aux->lock);
+	aux->closing = true;
+	while (aux->njobs)
+		pthread_cond_wait(&aux->cond, &aux->lock);
+	pthread_mutex_unlock(&aux->lock);
+
+	// Stop reading the shared-memory ring
+	if (aux->shm) {
+		__atomic_store_n(&aux->shmstop, true, __ATOMIC_RELEASE);
+		pthread_join(aux->shmthread, NULL);
+		close_shm_ring(aux->shm);
+	}
+
+	// set pipeline status to dead
+	if (aux->pipe)
+		release_pipe(aux->pipe);
+	if (aux->next) {
+		release_pipe(aux->next);
+		gst_buffer_unref(aux->nextframe);
+	}
+	
+	// The pool may still reference the texture if the texture manager
+	// is destroyed
+	pool_forget(tex);
+
+	pthread_mutex_destroy(&aux->lock);
+	pthread_cond_destroy(&aux->cond);
+	free_frame_index(aux->index);
+	free_frame_index(aux->nextindex);
+	free(aux->file);
+	free(aux->nextfile);
+	for (i=0; i<aux->nplaylist; i++)
+		free(aux->playlist[i]);
+	free(aux->playlist);
+	free(aux);
+	tex->aux = NULL;
+}
+
+
+/* Setup tex as a video texture whose frames come from pipe (NULL for
+ * the sources read without gstreamer)
+ */
+static
+struct videoaux* create_video_aux(struct dtk_texture* tex, GstElement* pipe,
+                                  int flags, const struct frame_size* maxsize)
+{
+	struct videoaux* aux;
 
 	aux = malloc(sizeof(*aux));
 	aux->pipe = pipe;
+	aux->maxsize = *maxsize;
 	aux->state = 0;
+	aux->zerocopy = flags & DTK_ZEROCOPY;
+	aux->readyfn = NULL;
+	aux->readydata = NULL;
+	aux->file = NULL;
+	aux->index = NULL;
+	aux->seekpending = false;
+	memset(&aux->seekstats, 0, sizeof(aux->seekstats));
+	aux->loop = false;
+	aux->playlist = NULL;
+	aux->nplaylist = aux->plpos = aux->plgen = 0;
+	aux->next = NULL;
+	aux->nextframe = NULL;
+	aux->nextfile = NULL;
+	aux->nextindex = NULL;
+	aux->ptsoffset = aux->lastend = 0;
+	aux->njobs = 0;
+	aux->closing = false;
+	memset(&aux->stats, 0, sizeof(aux->stats));
+	aux->haslastframe = false;
+	aux->jitter = 0;
+	aux->shm = NULL;
+	aux->shmstop = false;
+	aux->shmlatency = -1;
 	pthread_mutex_init(&aux->lock, NULL);
+	pthread_cond_init(&aux->cond, NULL);
 	tex->id = 0;
 	tex->isvideo = true;
 	tex->aux = aux;
 	tex->destroyfn = &(destroyPipeline);
+	tex->framefn = count_frame_event;
+
+	return aux;
+}
+
+
+// Assume holding tex->lock
+static
+int init_video_tex(struct dtk_texture* tex, GstElement* pipe, int flags,
+                   const struct frame_size* maxsize)
+{
+	GstAppSink* sink;
+	GstBus* bus;
+	int r, retval = 0;
+	int noblock = flags & DTK_NOBLOCKING;
+
+	sink = configure_sink(pipe, maxsize);
+	gst_app_sink_set_callbacks(sink, &sink_uninit_callbacks, tex, NULL);
+	gst_object_unref(sink);
+
+	create_video_aux(tex, pipe, flags, maxsize);
+
+	// Catch the errors occurring while the pipeline starts
+	bus = gst_element_get_bus(pipe);
+	gst_bus_set_sync_handler(bus, bus_sync_handler, tex);
+	gst_object_unref(bus);
 	
 	// Prepare pipeline execution
 	pthread_mutex_unlock(&tex->lock);
-	if (set_pipe_state(aux, GST_STATE_READY, noblock) < 0
-	  || (r = set_pipe_state(aux, GST_STATE_PAUSED, noblock)) < 0) 
-	  	retval = -1;
-	else if (!noblock)
-		wait_for_data_alloc(tex, (r == DTK_NO_PREROLL));
+	if (set_pipe_state(pipe, GST_STATE_READY, noblock) < 0
+	  || (r = set_pipe_state(pipe, GST_STATE_PAUSED, noblock)) < 0) {
+		notify_video_ready(tex, DTKV_ERROR);
+		retval = -1;
+	} else if (!noblock)
+		retval = wait_for_data_alloc(tex, (r == DTK_NO_PREROLL));
 	pthread_mutex_lock(&tex->lock);
 
 	return retval;
 }
 
 
+/* Copy the frames published in the shared-memory ring of a video
+ * texture into its back slot. The frames published while the video is
+ * paused are skipped.
+ */
+static
+void* shm_reader_thread(void* arg)
+{
+	struct dtk_texture* tex = arg;
+	struct videoaux* aux = tex->aux;
+	struct dtk_timespec now;
+	int64_t pts, latency;
+	void* slot = NULL;
+	bool taken = false;
+	int playing;
+
+	while (!__atomic_load_n(&aux->shmstop, __ATOMIC_ACQUIRE)) {
+		if (!wait_shm_frame(aux->shm, SHM_POLL_MS))
+			continue;
+
+		pthread_mutex_lock(&aux->lock);
+		playing = aux->state & DTKV_PLAYING;
+		pthread_mutex_unlock(&aux->lock);
+		if (!playing) {
+			skip_shm_frames(aux->shm);
+			continue;
+		}
+
+		// A frame overwritten while being read is skipped: the slot
+		// is kept for the next one. The slot is missing if its PBO
+		// could not be mapped.
+		if (!taken) {
+			slot = get_back_slot(tex);
+			taken = true;
+		}
+		if (!read_shm_frame(aux->shm, slot, &pts))
+			continue;
+		taken = false;
+
+		count_decoded_frame(aux);
+		if (pts >= 0) {
+			dtk_gettime(&now);
+			latency = (int64_t)now.sec*GST_SECOND + now.nsec - pts;
+			__atomic_store_n(&aux->shmlatency, latency/GST_USECOND,
+			                 __ATOMIC_RELAXED);
+		}
+		publish_back_slot(tex, pts);
+	}
+
+	return NULL;
+}
+
+
+/* Setup tex as a video texture whose frames are read from the
+ * shared-memory ring called name. Assume holding tex->lock.
+ */
+static
+int init_shm_tex(struct dtk_texture* tex, const char* name, int flags)
+{
+	static const struct frame_size nosize = {0, 0};
+	struct videoaux* aux;
+	unsigned int format, w, h;
+
+	// The frames are copied from the ring which may be overwritten at
+	// any time: no zero-copy
+	aux = create_video_aux(tex, NULL, flags & ~DTK_ZEROCOPY, &nosize);
+
+	aux->shm = open_shm_ring(name, &format, &w, &h);
+	if (!aux->shm
+	   || alloc_video_image(tex, w, h, format)
+	   || texture_data_size(tex) < dtk_shmv_framesize(format, w, h)
+	   || pthread_create(&aux->shmthread, NULL, shm_reader_thread, tex)) {
+		close_shm_ring(aux->shm);
+		aux->shm = NULL;
+		notify_video_ready(tex, DTKV_ERROR);
+		return -1;
+	}
+
+	// The frame format is known from the header of the ring
+	notify_video_ready(tex, DTKV_READY);
+	return 0;
+}
+
+
+/* Load the cached index of a video file or start building it for the
+ * next times the file is opened
+ */
+static
+void init_frame_index(struct videoaux* aux, const char* file)
+{
+	aux->file = strdup(file);
+	aux->index = load_frame_index(file);
+	if (!aux->index)
+		build_frame_index_async(file);
+}
+
+
+/* Format the identifier of a video texture and get the maximal size of
+ * its frames. The same source loaded with different sizes gives
+ * distinct textures. The frames of custom pipelines and of
+ * shared-memory rings are not scaled.
+ */
+static
+void format_video_id(char* id, struct frame_size* size, int type,
+                     const char* fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	size->w = __atomic_load_n(&target_size.w, __ATOMIC_RELAXED);
+	size->h = __atomic_load_n(&target_size.h, __ATOMIC_RELAXED);
+	if (type == VCUSTOM || type == VSHM || !size->w || !size->h)
+		size->w = size->h = 0;
+
+	va_start(ap, fmt);
+	len = vsnprintf(id, VIDEO_IDLEN, fmt, ap);
+	va_end(ap);
+
+	if (size->w && len >= 0 && len < VIDEO_IDLEN)
+		snprintf(id+len, VIDEO_IDLEN-len, "@%ux%u", size->w, size->h);
+}
+
+
 static
 dtk_htex create_video_any(int type, const union pipeopt* opt,
-                          const char* stringid, int flags)
+                          const char* stringid, int flags,
+                          const struct frame_size* maxsize)
 {
 	dtk_htex tex;
 	GstElement* pipe;
 	int noblock = flags & DTK_NOBLOCKING;
+	int r = 0;
 
 	if ((tex = get_texture(stringid)) == NULL)
 		return NULL;
 
 	pthread_mutex_lock(&(tex->lock));
-	if (!tex->aux) {
+	if (!tex->aux && type == VSHM) {
+		r = init_shm_tex(tex, opt->strval, flags);
+	} else if (!tex->aux) {
 		pipe = create_pipeline(type, opt);
-		init_video_tex(tex, pipe, noblock);
+		r = init_video_tex(tex, pipe, flags, maxsize);
+		if (type == VFILE)
+			init_frame_index(tex->aux, opt->strval);
 	}
 	pthread_mutex_unlock(&(tex->lock));
 
+	// Without DTK_NOBLOCKING, the texture is returned only if usable.
+	// Otherwise failures are reported by DTKV_ERROR.
+	if (r && !noblock) {
+		rem_texture(tex);
+		return NULL;
+	}
+
 	if (tex && (flags & DTK_AUTOSTART))
 		pipeline_play_pause(tex->aux, 1, noblock);
 		
@@ -381,6 +1337,250 @@ dtk_htex create_video_any(int type, const union pipeopt* opt,
 }
 
 
+/**************************************************************************
+ *                          Looping and playlist                          *
+ **************************************************************************/
+static void prepare_next_job(void* arg);
+
+/* Switch to the next clip of the playlist if it is pre-rolled or report
+ * the end of stream otherwise. Called when the current clip is over.
+ */
+static
+void end_of_clip(struct dtk_texture* tex)
+{
+	struct videoaux* aux = tex->aux;
+	GstElement* pipe;
+	GstBuffer* frame;
+	GstAppSink* sink;
+	GstBus* bus;
+	bool playing;
+
+	pthread_mutex_lock(&aux->lock);
+	if (!aux->next || schedule_job(tex, teardown_job, aux->pipe)) {
+		aux->state |= DTKV_EOS;
+		pthread_mutex_unlock(&aux->lock);
+		return;
+	}
+
+	// The previous pipeline is now owned by the teardown job
+	pipe = aux->pipe = aux->next;
+	frame = aux->nextframe;
+	aux->next = NULL;
+	aux->nextframe = NULL;
+	free(aux->file);
+	free_frame_index(aux->index);
+	aux->file = aux->nextfile;
+	aux->index = aux->nextindex;
+	aux->nextfile = NULL;
+	aux->nextindex = NULL;
+	aux->seekpending = false;
+	aux->state &= ~DTKV_EOS;
+	__atomic_store_n(&aux->ptsoffset, aux->ptsoffset + aux->lastend,
+	                 __ATOMIC_RELEASE);
+	playing = aux->state & DTKV_PLAYING;
+	gst_object_ref(pipe);
+	schedule_job(tex, prepare_next_job, NULL);
+	pthread_mutex_unlock(&aux->lock);
+
+	// The pre-rolled frame is shown without waiting the new pipeline
+	update_texture_image(frame, tex);
+
+	sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipe), "dtksink"));
+	gst_app_sink_set_callbacks(sink, &sink_callbacks, tex, NULL);
+	gst_object_unref(sink);
+	bus = gst_element_get_bus(pipe);
+	gst_bus_set_sync_handler(bus, bus_sync_handler, tex);
+	gst_object_unref(bus);
+
+	// Pause it again if a pause has been requested meanwhile
+	if (playing) {
+		set_pipe_state(pipe, GST_STATE_PLAYING, 1);
+		pthread_mutex_lock(&aux->lock);
+		playing = aux->state & DTKV_PLAYING;
+		pthread_mutex_unlock(&aux->lock);
+		if (!playing)
+			set_pipe_state(pipe, GST_STATE_PAUSED, 1);
+	}
+	gst_object_unref(pipe);
+}
+
+
+/* Called when the current pipeline has played its segment: restart it
+ * from the beginning without flushing so that no frame is missed
+ */
+static
+void segment_done_job(void* arg)
+{
+	struct video_job* job = arg;
+	struct dtk_texture* tex = job->tex;
+	struct videoaux* aux = tex->aux;
+	GstElement* pipe = NULL;
+
+	pthread_mutex_lock(&aux->lock);
+	if (aux->loop && !aux->nplaylist) {
+		__atomic_store_n(&aux->ptsoffset,
+		                 aux->ptsoffset + aux->lastend,
+		                 __ATOMIC_RELEASE);
+		pipe = gst_object_ref(aux->pipe);
+	}
+	pthread_mutex_unlock(&aux->lock);
+
+	if (pipe) {
+		gst_element_seek(pipe, 1.0, GST_FORMAT_TIME,
+		                 GST_SEEK_FLAG_SEGMENT,
+		                 GST_SEEK_TYPE_SET, 0,
+		                 GST_SEEK_TYPE_NONE, -1);
+		gst_object_unref(pipe);
+	} else
+		end_of_clip(tex);
+
+	end_job(job);
+}
+
+
+/* Create the pipeline of a clip and wait for its first frame. Returns
+ * NULL if it fails or if its frames cannot be shown in the texture.
+ */
+static
+GstElement* preroll_clip(struct dtk_texture* tex, const char* file,
+                         GstBuffer** frame)
+{
+	union pipeopt opt = {.strval = file};
+	GstElement* pipe;
+	GstAppSink* sink;
+	bool fit;
+
+	if (!(pipe = create_pipeline(VFILE, &opt)))
+		return NULL;
+
+	// The callbacks are set only when the clip becomes the current one
+	sink = configure_sink(pipe, &((struct videoaux*)tex->aux)->maxsize);
+	fit = (set_pipe_state(pipe, GST_STATE_READY, 0) == 0
+	       && set_pipe_state(pipe, GST_STATE_PAUSED, 0) == 0
+	       && frames_fit_texture(sink, tex)
+	       && (*frame = gst_app_sink_pull_preroll(sink)));
+	gst_object_unref(sink);
+
+	if (!fit) {
+		release_pipe(pipe);
+		return NULL;
+	}
+
+	return pipe;
+}
+
+
+/* Pre-roll the next clip of the playlist. The clips that cannot be
+ * opened or whose frames do not fit the texture are skipped.
+ */
+static
+void prepare_next_job(void* arg)
+{
+	struct video_job* job = arg;
+	struct dtk_texture* tex = job->tex;
+	struct videoaux* aux = tex->aux;
+	struct frame_index* index;
+	GstElement* pipe;
+	GstBuffer* frame;
+	unsigned int gen, ntry;
+	char* file;
+	bool atend, stale;
+
+	for (ntry = 0; ; ntry++) {
+		pthread_mutex_lock(&aux->lock);
+		if (aux->closing || aux->next || ntry >= aux->nplaylist
+		    || (aux->plpos >= aux->nplaylist && !aux->loop)) {
+			pthread_mutex_unlock(&aux->lock);
+			break;
+		}
+		if (aux->plpos >= aux->nplaylist)
+			aux->plpos = 0;
+		file = strdup(aux->playlist[aux->plpos++]);
+		gen = aux->plgen;
+		pthread_mutex_unlock(&aux->lock);
+
+		frame = NULL;
+		pipe = file ? preroll_clip(tex, file, &frame) : NULL;
+		index = NULL;
+		if (pipe && !(index = load_frame_index(file)))
+			build_frame_index_async(file);
+
+		pthread_mutex_lock(&aux->lock);
+		stale = (gen != aux->plgen || aux->closing || aux->next);
+		if (pipe && !stale) {
+			aux->next = pipe;
+			aux->nextframe = frame;
+			aux->nextfile = file;
+			aux->nextindex = index;
+			atend = aux->state & DTKV_EOS;
+			pthread_mutex_unlock(&aux->lock);
+
+			// The current clip has ended before its successor
+			if (atend)
+				end_of_clip(tex);
+			break;
+		}
+		pthread_mutex_unlock(&aux->lock);
+
+		if (pipe) {
+			release_pipe(pipe);
+			gst_buffer_unref(frame);
+		}
+		free_frame_index(index);
+		free(file);
+		if (stale)
+			break;
+	}
+
+	end_job(job);
+}
+
+
+/* Enable or disable the looping. Without playlist, the current clip is
+ * restarted within a segment from its current position.
+ */
+static
+int pipeline_set_loop(struct dtk_texture* tex, bool loop)
+{
+	struct videoaux* aux = tex->aux;
+	int flag = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE
+	           | GST_SEEK_FLAG_SEGMENT;
+	GstFormat fmt = GST_FORMAT_TIME;
+	GstElement* pipe = NULL;
+	gint64 pos;
+	bool atend;
+	int ret = 0;
+
+	pthread_mutex_lock(&aux->lock);
+	aux->loop = loop;
+	atend = aux->state & DTKV_EOS;
+	if (loop && !aux->nplaylist)
+		pipe = gst_object_ref(aux->pipe);
+	else if (loop && !aux->next)
+		schedule_job(tex, prepare_next_job, NULL);
+	pthread_mutex_unlock(&aux->lock);
+
+	if (!pipe)
+		return 0;
+
+	if (atend || !gst_element_query_position(pipe, &fmt, &pos))
+		pos = 0;
+
+	if (!gst_element_seek(pipe, 1.0, GST_FORMAT_TIME, flag,
+	                      GST_SEEK_TYPE_SET, pos, GST_SEEK_TYPE_NONE, -1))
+		ret = -1;
+	gst_object_unref(pipe);
+
+	if (!ret) {
+		pthread_mutex_lock(&aux->lock);
+		aux->state &= ~DTKV_EOS;
+		pthread_mutex_unlock(&aux->lock);
+	}
+
+	return ret;
+}
+
+
 /**************************************************************************
  *                    Video related API implementation                    *
  **************************************************************************/
@@ -388,13 +1588,14 @@ API_EXPORTED
 dtk_htex dtk_load_video_tcp(int flags, const char *server, int port)
 {
 	union pipeopt opt[] = {{.strval = server}, {.intval = port}};
-	char stringid[255];
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
 
 	if (port < 1 || !server)
 		return NULL;
 
-	sprintf(stringid, "TCP:%s:%d", server, port);
-	return create_video_any(VTCP, opt, stringid, flags);
+	format_video_id(stringid, &size, VTCP, "TCP:%s:%d", server, port);
+	return create_video_any(VTCP, opt, stringid, flags, &size);
 }
 
 
@@ -402,13 +1603,14 @@ API_EXPORTED
 dtk_htex dtk_load_video_udp(int flags, int port)
 {
 	union pipeopt opt = {.intval = port};
-	char stringid[255];
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
 
 	if (port < 1)
 		return NULL;
 
-	sprintf(stringid, "UDP:%d", port);
-	return create_video_any(VUDP, &opt, stringid, flags);
+	format_video_id(stringid, &size, VUDP, "UDP:%d", port);
+	return create_video_any(VUDP, &opt, stringid, flags, &size);
 }
 
 
@@ -416,13 +1618,117 @@ API_EXPORTED
 dtk_htex dtk_load_video_file(int flags, const char *file)
 {
 	union pipeopt opt = {.strval=file};
-	char stringid[255];
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
 
 	if (!file)
 		return NULL;
 
-	sprintf(stringid, "FILE:%s", file);
-	return create_video_any(VFILE, &opt, stringid, flags);
+	format_video_id(stringid, &size, VFILE, "FILE:%s", file);
+	pool_account_load(stringid);
+	return create_video_any(VFILE, &opt, stringid, flags, &size);
+}
+
+
+API_EXPORTED
+int dtk_video_preload(int flags, const char* file)
+{
+	union pipeopt opt = {.strval=file};
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
+	struct dtk_timespec start, stop;
+	struct pool_entry* clips;
+	dtk_htex evicted[2], tex;
+	unsigned int nevict = 0;
+	long warmup;
+	int i, retval = 0;
+	bool ready;
+
+	if (!file)
+		return -1;
+	format_video_id(stringid, &size, VFILE, "FILE:%s", file);
+
+	// A clip already in the pool is only rewound if it has been handed
+	// out. The pool lock is released while waiting for the preroll.
+	pthread_mutex_lock(&vpool.lock);
+	if ((i = pool_find(stringid)) >= 0) {
+		tex = vpool.clips[i].tex;
+		vpool.clips[i].lastused = ++vpool.tick;
+		if (vpool.clips[i].armed || vpool.clips[i].busy) {
+			pthread_mutex_unlock(&vpool.lock);
+			return 0;
+		}
+		vpool.clips[i].busy = true;
+		pthread_mutex_unlock(&vpool.lock);
+
+		retval = rewind_clip(tex);
+
+		// The clip was kept in the pool but the pool may have been
+		// shrunk meanwhile
+		pthread_mutex_lock(&vpool.lock);
+		if ((i = pool_find(stringid)) >= 0) {
+			vpool.clips[i].busy = false;
+			vpool.clips[i].armed = (retval == 0);
+		}
+		nevict = pool_evict(vpool.maxsize, evicted);
+		pthread_mutex_unlock(&vpool.lock);
+
+		while (nevict)
+			rem_texture(evicted[--nevict]);
+		return retval;
+	}
+	pthread_mutex_unlock(&vpool.lock);
+
+	// Create the pipeline and wait for its preroll
+	dtk_gettime(&start);
+	flags &= DTK_ZEROCOPY;
+	tex = create_video_any(VFILE, &opt, stringid, flags, &size);
+	if (!tex)
+		return -1;
+	dtk_gettime(&stop);
+	warmup = dtk_difftime_ms(&stop, &start);
+
+	pthread_mutex_lock(&tex->lock);
+	ready = (tex->data != NULL);
+	pthread_mutex_unlock(&tex->lock);
+
+	pthread_mutex_lock(&vpool.lock);
+	if (!ready || pool_find(stringid) >= 0 || !vpool.maxsize) {
+		// Failed, preloaded concurrently or no pool
+		evicted[nevict++] = tex;
+		retval = ready ? 0 : -1;
+	} else {
+		// Make room and insert the clip
+		if (vpool.num == vpool.size) {
+			i = vpool.size ? 2*vpool.size : VIDEO_POOL_DEFSIZE;
+			clips = realloc(vpool.clips, i*sizeof(*clips));
+			if (clips) {
+				vpool.clips = clips;
+				vpool.size = i;
+			}
+		}
+		// Clips being rewound may keep the pool full
+		nevict = pool_evict(vpool.maxsize-1, evicted);
+		if (vpool.num < vpool.size && vpool.num < vpool.maxsize) {
+			vpool.clips[vpool.num].tex = tex;
+			vpool.clips[vpool.num].lastused = ++vpool.tick;
+			vpool.clips[vpool.num].armed = true;
+			vpool.clips[vpool.num].busy = false;
+			vpool.stats.num_clips = ++vpool.num;
+			vpool.stats.warmup_ms += warmup;
+			if (warmup > vpool.stats.max_warmup_ms)
+				vpool.stats.max_warmup_ms = warmup;
+		} else {
+			evicted[nevict++] = tex;
+			retval = -1;
+		}
+	}
+	pthread_mutex_unlock(&vpool.lock);
+
+	while (nevict)
+		rem_texture(evicted[--nevict]);
+
+	return retval;
 }
 
 
@@ -430,20 +1736,40 @@ API_EXPORTED
 dtk_htex dtk_load_video_gst(int flags, const char* desc)
 {
 	union pipeopt opt = {.strval=desc};
-	char stringid[255];
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
 
 	if (!desc)
 		return NULL;
 
-	sprintf(stringid, "CUSTOM:%s", desc);
-	return create_video_any(VCUSTOM, &opt, stringid, flags);
+	format_video_id(stringid, &size, VCUSTOM, "CUSTOM:%s", desc);
+	return create_video_any(VCUSTOM, &opt, stringid, flags, &size);
+}
+
+
+API_EXPORTED
+dtk_htex dtk_load_video_shm(int flags, const char* name)
+{
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
+	union pipeopt opt = {.strval = name};
+
+	if (!name)
+		return NULL;
+
+	format_video_id(stringid, &size, VSHM, "SHM:%s", name);
+	return create_video_any(VSHM, &opt, stringid, flags, &size);
 }
 
 
 API_EXPORTED
 dtk_htex dtk_load_video_test(int flags)
 {
-	return create_video_any(VTEST, NULL, "TESTPIPE", flags);
+	char stringid[VIDEO_IDLEN];
+	struct frame_size size;
+
+	format_video_id(stringid, &size, VTEST, "TESTPIPE");
+	return create_video_any(VTEST, NULL, stringid, flags, &size);
 }
 
 
@@ -474,6 +1800,11 @@ int dtk_video_exec(dtk_htex video, int command, const void* arg)
 
 	if (!video->isvideo)
 		return -1;
+
+	// Only the play state of the sources without pipeline is controlled
+	if (!((struct videoaux*)video->aux)->pipe
+	   && command != DTKV_CMD_PLAY && command != DTKV_CMD_PAUSE)
+		return -1;
 	
 	switch (command) {
 	case DTKV_CMD_SEEK:
@@ -481,6 +1812,11 @@ int dtk_video_exec(dtk_htex video, int command, const void* arg)
 			seek_pos = *((const long*)arg) * GST_MSECOND;
 		return pipeline_seek(video->aux, seek_pos);
 
+	case DTKV_CMD_SEEK_ACCURATE:
+		if (arg)
+			seek_pos = *((const long*)arg) * GST_MSECOND;
+		return pipeline_seek_accurate(video->aux, seek_pos);
+
 	case DTKV_CMD_PLAY:
 	case DTKV_CMD_PAUSE:
 		if (arg)
@@ -488,8 +1824,245 @@ int dtk_video_exec(dtk_htex video, int command, const void* arg)
 		playing = (command == DTKV_CMD_PLAY); 
 		return pipeline_play_pause(video->aux, playing, noblock);
 
+	case DTKV_CMD_LOOP:
+		return pipeline_set_loop(video, !arg || *((const int*)arg));
+
 	default:
 		return -1;
 	}
 }
 
+
+
+API_EXPORTED
+long dtk_video_present(dtk_htex video, long time)
+{
+	int64_t pts;
+
+	if (!video->isvideo)
+		return -1;
+
+	// Back to the display of the newest frame
+	if (time < 0) {
+		video->timed = false;
+		return -1;
+	}
+
+	video->timed = true;
+	pts = select_frame(video, (int64_t)time * GST_MSECOND);
+	return (pts < 0) ? -1 : (long)(pts / GST_MSECOND);
+}
+
+
+API_EXPORTED
+void dtk_video_set_target_size(unsigned int width, unsigned int height)
+{
+	__atomic_store_n(&target_size.w, width, __ATOMIC_RELAXED);
+	__atomic_store_n(&target_size.h, height, __ATOMIC_RELAXED);
+}
+
+
+API_EXPORTED
+void dtk_video_set_poolsize(unsigned int nclips)
+{
+	dtk_htex* evicted;
+	unsigned int nevict = 0;
+
+	pthread_mutex_lock(&vpool.lock);
+	vpool.maxsize = nclips;
+	evicted = malloc((vpool.num+1)*sizeof(*evicted));
+	if (evicted)
+		nevict = pool_evict(nclips, evicted);
+	pthread_mutex_unlock(&vpool.lock);
+
+	while (nevict)
+		rem_texture(evicted[--nevict]);
+	free(evicted);
+}
+
+
+API_EXPORTED
+void dtk_video_getpoolstats(struct dtk_video_poolstats* stats)
+{
+	if (!stats)
+		return;
+
+	pthread_mutex_lock(&vpool.lock);
+	*stats = vpool.stats;
+	pthread_mutex_unlock(&vpool.lock);
+}
+
+
+API_EXPORTED
+int dtk_video_set_ready_callback(dtk_htex video, dtk_video_readyfn fn,
+                                 void* data)
+{
+	struct videoaux* aux;
+	int state;
+
+	if (!video->isvideo)
+		return -1;
+
+	aux = video->aux;
+	pthread_mutex_lock(&aux->lock);
+	aux->readyfn = fn;
+	aux->readydata = data;
+	state = aux->state;
+	pthread_mutex_unlock(&aux->lock);
+
+	// The notification has already been sent
+	if (fn && (state & (DTKV_READY | DTKV_ERROR)))
+		fn(video, state, data);
+
+	return 0;
+}
+
+
+API_EXPORTED
+int dtk_video_getseekstats(dtk_htex video, struct dtk_video_seekstats* stats)
+{
+	struct videoaux* aux;
+
+	if (!video->isvideo || !stats)
+		return -1;
+
+	aux = video->aux;
+	pthread_mutex_lock(&aux->lock);
+	*stats = aux->seekstats;
+	stats->indexed = (aux->index != NULL);
+	pthread_mutex_unlock(&aux->lock);
+
+	return 0;
+}
+
+
+API_EXPORTED
+int dtk_video_set_playlist(dtk_htex video, unsigned int num,
+                           const char* const* files)
+{
+	struct videoaux* aux;
+	struct frame_index* index;
+	GstElement* next;
+	GstBuffer* frame;
+	char **list = NULL, **oldlist, *file;
+	unsigned int i, oldnum;
+	bool loop;
+
+	if (!video->isvideo || (num && !files)
+	   || !((struct videoaux*)video->aux)->pipe)
+		return -1;
+
+	// Copy the list of files
+	if (num && !(list = calloc(num, sizeof(*list))))
+		return -1;
+	for (i=0; i<num; i++) {
+		if (!files[i] || !(list[i] = strdup(files[i]))) {
+			while (i)
+				free(list[--i]);
+			free(list);
+			return -1;
+		}
+	}
+
+	// Replace the playlist and the clip pre-rolled from the old one
+	aux = video->aux;
+	pthread_mutex_lock(&aux->lock);
+	oldlist = aux->playlist;
+	oldnum = aux->nplaylist;
+	aux->playlist = list;
+	aux->nplaylist = num;
+	aux->plpos = 0;
+	aux->plgen++;
+	next = aux->next;
+	frame = aux->nextframe;
+	file = aux->nextfile;
+	index = aux->nextindex;
+	aux->next = NULL;
+	aux->nextframe = NULL;
+	aux->nextfile = NULL;
+	aux->nextindex = NULL;
+	loop = aux->loop;
+	if (num)
+		schedule_job(video, prepare_next_job, NULL);
+	pthread_mutex_unlock(&aux->lock);
+
+	if (next) {
+		release_pipe(next);
+		gst_buffer_unref(frame);
+	}
+	free_frame_index(index);
+	free(file);
+	for (i=0; i<oldnum; i++)
+		free(oldlist[i]);
+	free(oldlist);
+
+	// Without playlist, the current clip loops on itself
+	if (!num && loop)
+		return pipeline_set_loop(video, true);
+
+	return 0;
+}
+
+
+/* Get the latency of the pipeline reported by its elements, plus the
+ * lateness of the last frame dropped by QoS. Returns -1 if unknown.
+ */
+static
+long get_pipeline_latency(struct videoaux* aux)
+{
+	GstElement* pipe;
+	GstQuery* query;
+	GstClockTime min = 0;
+	gint64 jitter;
+	gboolean live, ok;
+
+	// Age of the last frame read from a shared-memory ring
+	if (!aux->pipe)
+		return __atomic_load_n(&aux->shmlatency, __ATOMIC_RELAXED);
+
+	pipe = ref_pipe(aux);
+	query = gst_query_new_latency();
+	ok = gst_element_query(pipe, query);
+	if (ok)
+		gst_query_parse_latency(query, &live, &min, NULL);
+	gst_query_unref(query);
+	gst_object_unref(pipe);
+
+	if (!ok || !GST_CLOCK_TIME_IS_VALID(min))
+		return -1;
+
+	jitter = __atomic_load_n(&aux->jitter, __ATOMIC_RELAXED);
+	if (jitter > 0)
+		min += jitter;
+
+	return min / GST_USECOND;
+}
+
+
+API_EXPORTED
+int dtk_video_getstats(dtk_htex video, struct dtk_video_stats* stats)
+{
+	struct dtk_video_stats* st;
+	struct videoaux* aux;
+	unsigned int i;
+
+	if (!video->isvideo || !stats)
+		return -1;
+
+	// The counters are updated concurrently
+	aux = video->aux;
+	st = &aux->stats;
+	stats->decoded = __atomic_load_n(&st->decoded, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&st->dropped, __ATOMIC_RELAXED);
+	stats->uploaded = __atomic_load_n(&st->uploaded, __ATOMIC_RELAXED);
+	stats->presented = __atomic_load_n(&st->presented, __ATOMIC_RELAXED);
+	for (i=0; i<DTKV_NBINS; i++) {
+		stats->decode_hist[i] = __atomic_load_n(st->decode_hist+i,
+		                                        __ATOMIC_RELAXED);
+		stats->upload_hist[i] = __atomic_load_n(st->upload_hist+i,
+		                                        __ATOMIC_RELAXED);
+	}
+
+	stats->latency_us = get_pipeline_latency(aux);
+	return 0;
+}
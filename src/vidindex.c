@@ -0,0 +1,390 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#ifndef G_DISABLE_CAST_CHECKS
+#define G_DISABLE_CAST_CHECKS	1
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gst/gst.h>
+#include <glib.h>
+#include <gst/app/gstappsink.h>
+
+#include "vidpipe_creation.h"
+#include "vidindex.h"
+
+// The index of a video file is cached in a file next to it
+#define IDX_SUFFIX	".dtkidx"
+#define IDX_TMPSUFFIX	".dtkidx.tmp"
+#define IDX_MAGIC	"DTKIDX1"
+
+// Time after which an unfinished index is considered abandoned (s)
+#define IDX_STALE_TIME	3600
+
+struct idx_header
+{
+	char magic[8];
+	uint64_t filesize;
+	int64_t mtime;
+	uint32_t num;
+	uint32_t reserved;
+};
+
+struct index_job
+{
+	char* file;
+	FILE* fp;
+};
+
+// Index being filled by the streaming thread of the scanning pipeline
+struct scan_state
+{
+	struct frame_index* index;
+	unsigned int size;
+};
+
+
+static
+char* index_path(const char* file, const char* suffix)
+{
+	char* path;
+
+	if ((path = malloc(strlen(file) + strlen(suffix) + 1))) {
+		strcpy(path, file);
+		strcat(path, suffix);
+	}
+	return path;
+}
+
+
+/* Fill the header identifying the current version of the video file
+ */
+static
+int fill_header(struct idx_header* hdr, const char* file)
+{
+	struct stat st;
+
+	if (stat(file, &st))
+		return -1;
+
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->magic, IDX_MAGIC, sizeof(IDX_MAGIC));
+	hdr->filesize = st.st_size;
+	hdr->mtime = st.st_mtime;
+	return 0;
+}
+
+
+static
+int grow_index(struct frame_index* index, unsigned int size)
+{
+	int64_t* pts;
+	uint8_t* key;
+
+	if (!(pts = realloc(index->pts, size*sizeof(*pts))))
+		return -1;
+	index->pts = pts;
+	if (!(key = realloc(index->key, size*sizeof(*key))))
+		return -1;
+	index->key = key;
+	return 0;
+}
+
+
+/* Record the frame received by the appsink of the scanning pipeline.
+ * Called in its streaming thread.
+ */
+static
+GstFlowReturn scan_buffer_cb(GstAppSink* sink, gpointer data)
+{
+	struct scan_state* scan = data;
+	struct frame_index* index = scan->index;
+	GstBuffer* buffer;
+	GstClockTime ts;
+
+	if (!(buffer = gst_app_sink_pull_buffer(sink)))
+		return GST_FLOW_OK;
+
+	ts = GST_BUFFER_TIMESTAMP(buffer);
+	if (index->num == scan->size
+	   && !grow_index(index, scan->size ? 2*scan->size : 1024))
+		scan->size = scan->size ? 2*scan->size : 1024;
+
+	// Frames without timestamp cannot be targeted
+	if (GST_CLOCK_TIME_IS_VALID(ts) && index->num < scan->size) {
+		index->pts[index->num] = ts;
+		index->key[index->num++] = !GST_BUFFER_FLAG_IS_SET(buffer,
+		                               GST_BUFFER_FLAG_DELTA_UNIT);
+	}
+	gst_buffer_unref(buffer);
+	return GST_FLOW_OK;
+}
+
+
+/* Decode the whole file as fast as possible and record the timestamp of
+ * each frame and whether the decoder has flagged it as a keyframe
+ */
+static
+int scan_frames(const char* file, struct frame_index* index)
+{
+	union pipeopt opt = {.strval = file};
+	struct scan_state scan = {.index = index, .size = 0};
+	GstAppSinkCallbacks callbacks = {.new_buffer = scan_buffer_cb};
+	GstElement* pipe;
+	GstAppSink* sink;
+	GstMessage* msg;
+	GstBus* bus;
+	int ret = -1;
+
+	if (!(pipe = create_pipeline(VFILE, &opt)))
+		return -1;
+
+	sink = GST_APP_SINK(gst_bin_get_by_name(GST_BIN(pipe), "dtksink"));
+	g_object_set(sink, "sync", FALSE, NULL);
+	gst_app_sink_set_callbacks(sink, &callbacks, &scan, NULL);
+	gst_element_set_state(pipe, GST_STATE_PLAYING);
+
+	// The stream ends with an EOS or an error, never with both
+	bus = gst_element_get_bus(pipe);
+	msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+	                                 GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+	// Stopping the pipeline waits for its streaming thread, so the index
+	// is complete once done. It is incomplete if an error has occurred.
+	gst_element_set_state(pipe, GST_STATE_NULL);
+	if (msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS && index->num)
+		ret = 0;
+
+	if (msg)
+		gst_message_unref(msg);
+	gst_object_unref(bus);
+	gst_object_unref(sink);
+	gst_object_unref(pipe);
+	return ret;
+}
+
+
+static
+int write_index(FILE* fp, const char* file, const struct frame_index* index)
+{
+	struct idx_header hdr;
+
+	if (fill_header(&hdr, file))
+		return -1;
+	hdr.num = index->num;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1
+	   || fwrite(index->pts, sizeof(*index->pts), index->num, fp)
+	                                                    != index->num
+	   || fwrite(index->key, sizeof(*index->key), index->num, fp)
+	                                                    != index->num)
+		return -1;
+
+	return 0;
+}
+
+
+static
+void* index_thread(void* arg)
+{
+	struct index_job* job = arg;
+	struct frame_index index = {.num = 0, .pts = NULL, .key = NULL};
+	char *path, *tmppath;
+	int ret;
+
+	ret = scan_frames(job->file, &index);
+	if (!ret)
+		ret = write_index(job->fp, job->file, &index);
+	if (fclose(job->fp))
+		ret = -1;
+
+	// Publish the index atomically
+	path = index_path(job->file, IDX_SUFFIX);
+	tmppath = index_path(job->file, IDX_TMPSUFFIX);
+	if (path && tmppath && (ret || rename(tmppath, path)))
+		unlink(tmppath);
+
+	free(path);
+	free(tmppath);
+	free(index.pts);
+	free(index.key);
+	free(job->file);
+	free(job);
+	return NULL;
+}
+
+
+/* Create the temporary file of the index unless another build is running,
+ * removing the leftover of an interrupted build
+ */
+static
+FILE* create_tmp_index(const char* file)
+{
+	struct stat st;
+	char* tmppath;
+	int fd;
+
+	if (!(tmppath = index_path(file, IDX_TMPSUFFIX)))
+		return NULL;
+
+	fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0 && !stat(tmppath, &st)
+	   && time(NULL) - st.st_mtime > IDX_STALE_TIME) {
+		unlink(tmppath);
+		fd = open(tmppath, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	}
+	free(tmppath);
+
+	return (fd >= 0) ? fdopen(fd, "wb") : NULL;
+}
+
+
+/**************************************************************************
+ *                          Index API functions                           *
+ **************************************************************************/
+/* Load the cached index of the video file. Returns NULL if it does not
+ * exist or has been built for another version of the file.
+ */
+LOCAL_FN
+struct frame_index* load_frame_index(const char* file)
+{
+	struct idx_header hdr, ref;
+	struct frame_index* index = NULL;
+	char* path;
+	FILE* fp;
+
+	if (fill_header(&ref, file) || !(path = index_path(file, IDX_SUFFIX)))
+		return NULL;
+	fp = fopen(path, "rb");
+	free(path);
+	if (!fp)
+		return NULL;
+
+	if (fread(&hdr, sizeof(hdr), 1, fp) != 1
+	   || memcmp(hdr.magic, ref.magic, sizeof(hdr.magic))
+	   || hdr.filesize != ref.filesize || hdr.mtime != ref.mtime
+	   || !hdr.num)
+		goto exit;
+
+	if (!(index = calloc(1, sizeof(*index))))
+		goto exit;
+	index->num = hdr.num;
+	if (grow_index(index, hdr.num)
+	   || fread(index->pts, sizeof(*index->pts), hdr.num, fp) != hdr.num
+	   || fread(index->key, sizeof(*index->key), hdr.num, fp) != hdr.num) {
+		free_frame_index(index);
+		index = NULL;
+	}
+
+exit:
+	fclose(fp);
+	return index;
+}
+
+
+LOCAL_FN
+void free_frame_index(struct frame_index* index)
+{
+	if (!index)
+		return;
+
+	free(index->pts);
+	free(index->key);
+	free(index);
+}
+
+
+/* Build the index of the video file in a detached thread. Returns -1 if it
+ * is not a regular file or if the index cannot be written or is already
+ * being built.
+ */
+LOCAL_FN
+int build_frame_index_async(const char* file)
+{
+	struct index_job* job;
+	pthread_attr_t attr;
+	pthread_t thid;
+	struct stat st;
+	char* tmppath;
+	int ret;
+
+	if (stat(file, &st) || !S_ISREG(st.st_mode)
+	   || !(job = malloc(sizeof(*job))))
+		return -1;
+	job->file = strdup(file);
+	if (!job->file || !(job->fp = create_tmp_index(file))) {
+		free(job->file);
+		free(job);
+		return -1;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thid, &attr, index_thread, job);
+	pthread_attr_destroy(&attr);
+	if (!ret)
+		return 0;
+
+	fclose(job->fp);
+	if ((tmppath = index_path(file, IDX_TMPSUFFIX)))
+		unlink(tmppath);
+	free(tmppath);
+	free(job->file);
+	free(job);
+	return -1;
+}
+
+
+/* Find the last frame displayed at pos. Returns its position in the index
+ * and sets pts to its timestamp and ndecode to the number of frames to
+ * decode after the previous keyframe to reach it.
+ */
+LOCAL_FN
+int find_index_frame(const struct frame_index* index, int64_t pos,
+                     int64_t* pts, unsigned int* ndecode)
+{
+	unsigned int lo = 0, hi = index->num, mid, k;
+
+	// Binary search of the last frame whose timestamp is <= pos
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (index->pts[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	for (k = lo; k > 0 && !index->key[k]; k--);
+
+	*pts = index->pts[lo];
+	*ndecode = lo - k;
+	return lo;
+}
@@ -0,0 +1,38 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef VIDINDEX_H
+#define VIDINDEX_H
+
+#include <stdint.h>
+
+// Timestamps of the frames of a video file with the keyframes flagged
+struct frame_index
+{
+	unsigned int num;
+	int64_t* pts;
+	uint8_t* key;
+};
+
+LOCAL_FN struct frame_index* load_frame_index(const char* file);
+LOCAL_FN void free_frame_index(struct frame_index* index);
+LOCAL_FN int build_frame_index_async(const char* file);
+LOCAL_FN int find_index_frame(const struct frame_index* index, int64_t pos,
+                              int64_t* pts, unsigned int* ndecode);
+
+#endif
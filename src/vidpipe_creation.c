@@ -256,7 +256,11 @@ GstElement* create_pipeline(int type, const union pipeopt* opt)
 		pipe_add_element(&pl, "videotestsrc", "test-src");
 	
 	pipe_add_element(&pl, "decodebin2", "decoder-bin");
+	// The converter runs in passthrough mode when the decoder outputs
+	// a format accepted by the sink (I420, NV12, GRAY8). So does the
+	// scaler unless the sink caps restrict the frame size.
 	pipe_add_element(&pl, "ffmpegcolorspace", "converter");
+	pipe_add_element(&pl, "videoscale", "scaler");
 	pipe_add_element_full(&pl, "appsink", "dtksink", NULL);
 
 	setup_pipe_links(&pl);
@@ -32,6 +32,7 @@ union pipeopt
 #define VFILE	2
 #define VTEST	3
 #define VCUSTOM	4
+#define VSHM	5
 
 LOCAL_FN GstElement* create_pipeline(int type, const union pipeopt* opt);
 
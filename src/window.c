@@ -25,6 +25,7 @@
 #include "drawtk.h"
 #include "window.h" 
 #include "texmanager.h"
+#include "shader.h"
 #include "dtk_event.h"
 
 
@@ -187,6 +188,9 @@ void dtk_clear_screen(dtk_hwnd wnd)
 API_EXPORTED
 void dtk_update_screen(dtk_hwnd wnd)  
 {                         
+	// Continue the pending texture uploads with the frame budget
+	process_texture_uploads();
+
 	// Update screen
 	SDL_GL_SwapWindow(wnd->window);
 }
@@ -213,6 +217,7 @@ void dtk_close(dtk_hwnd wnd)
 	// This assumption might be wrong in case of multiple windows
 	// support
 	release_texture_manager();
+	release_shader_programs();
 	SDL_GL_DeleteContext(wnd->context);
 	SDL_DestroyWindow(wnd->window);
 
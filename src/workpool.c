@@ -0,0 +1,184 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "workpool.h"
+
+#ifndef MAX_WORKERS
+#define MAX_WORKERS	4
+#endif
+
+struct work
+{
+	workfn fn;
+	void* arg;
+	struct work* next;
+};
+
+// Pool of threads executing the queued work in FIFO order
+struct workpool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct work *head, *tail;
+	pthread_t threads[MAX_WORKERS];
+	unsigned int nthread;
+	bool stop;
+};
+
+static struct workpool pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.head = NULL,
+	.tail = NULL,
+	.nthread = 0,
+	.stop = false,
+};
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Internal functions                           *
+ *                                                                       *
+ *************************************************************************/
+static
+void* worker_thread(void* data)
+{
+	struct work* work;
+	(void)data;
+
+	pthread_mutex_lock(&pool.lock);
+	while (1) {
+		// Wait for work. Exit only when the queue is drained
+		while (!pool.head && !pool.stop)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		if (!pool.head)
+			break;
+
+		work = pool.head;
+		pool.head = work->next;
+		if (!pool.head)
+			pool.tail = NULL;
+
+		pthread_mutex_unlock(&pool.lock);
+		work->fn(work->arg);
+		free(work);
+		pthread_mutex_lock(&pool.lock);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+
+/* Start the worker threads, one per online processor but the one running
+ * the display. Assume that pool.lock is hold.
+ */
+static
+int start_workers(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int num;
+
+	num = (ncpu > 1) ? ncpu - 1 : 1;
+	if (num > MAX_WORKERS)
+		num = MAX_WORKERS;
+
+	pool.stop = false;
+	while (pool.nthread < num) {
+		if (pthread_create(&pool.threads[pool.nthread], NULL,
+		                   worker_thread, NULL))
+			break;
+		pool.nthread++;
+	}
+
+	return pool.nthread ? 0 : -1;
+}
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Workpool functions                           *
+ *                                                                       *
+ *************************************************************************/
+/* Queue fn(arg) to be executed on one of the worker threads. The workers
+ * are started on the first call. Fails while the pool is being stopped:
+ * the work could be left queued without worker.
+ */
+LOCAL_FN
+int submit_work(workfn fn, void* arg)
+{
+	struct work* work;
+	int ret = 0;
+
+	if (!(work = malloc(sizeof(*work))))
+		return -1;
+	work->fn = fn;
+	work->arg = arg;
+	work->next = NULL;
+
+	pthread_mutex_lock(&pool.lock);
+	if (pool.stop || (!pool.nthread && start_workers())) {
+		free(work);
+		ret = -1;
+		goto out;
+	}
+
+	if (pool.tail)
+		pool.tail->next = work;
+	else
+		pool.head = work;
+	pool.tail = work;
+	pthread_cond_signal(&pool.cond);
+
+out:
+	pthread_mutex_unlock(&pool.lock);
+	return ret;
+}
+
+
+/* Wait for all queued work to be done and stop the workers. Work
+ * submitted meanwhile, even by the running jobs, is refused. The workers
+ * will be started again at the next submission.
+ */
+LOCAL_FN
+void stop_workpool(void)
+{
+	unsigned int i, num;
+
+	pthread_mutex_lock(&pool.lock);
+	num = pool.nthread;
+	pool.stop = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+
+	for (i=0; i<num; i++)
+		pthread_join(pool.threads[i], NULL);
+
+	pthread_mutex_lock(&pool.lock);
+	pool.nthread = 0;
+	pool.stop = false;
+	pthread_mutex_unlock(&pool.lock);
+}
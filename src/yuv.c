@@ -0,0 +1,184 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdint.h>
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
+
+#include "texmanager.h"
+
+/* Conversion of video frames from YUV (BT.601, limited range) to RGBA,
+ * used when the context cannot run the conversion program. The integer
+ * coefficients are in 1/64 units:
+ *   R = 1.164*(Y-16) + 1.596*(V-128)
+ *   G = 1.164*(Y-16) - 0.391*(U-128) - 0.813*(V-128)
+ *   B = 1.164*(Y-16) + 2.018*(U-128)
+ */
+#define CY	74
+#define CRV	102
+#define CGU	25
+#define CGV	52
+#define CBU	129
+
+// Convert one row. Chroma samples are shared by 2 pixels and are cstep
+// bytes apart. Each function returns the number of pixels done.
+typedef unsigned int (*yuvfn)(uint8_t* restrict dst, const uint8_t* y,
+                              const uint8_t* u, const uint8_t* v,
+                              unsigned int cstep, unsigned int w);
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Conversion kernels                           *
+ *                                                                       *
+ *************************************************************************/
+static inline
+uint8_t clamp_u8(int x)
+{
+	return (x < 0) ? 0 : ((x > 255) ? 255 : x);
+}
+
+
+static
+unsigned int yuv_row_scalar(uint8_t* restrict dst, const uint8_t* y,
+                            const uint8_t* u, const uint8_t* v,
+                            unsigned int cstep, unsigned int w)
+{
+	unsigned int i;
+	int yy, uu, vv;
+
+	for (i=0; i<w; i++) {
+		yy = CY * (y[i] - 16);
+		uu = u[(i/2)*cstep] - 128;
+		vv = v[(i/2)*cstep] - 128;
+		dst[4*i] = clamp_u8((yy + CRV*vv + 32) >> 6);
+		dst[4*i+1] = clamp_u8((yy - CGU*uu - CGV*vv + 32) >> 6);
+		dst[4*i+2] = clamp_u8((yy + CBU*uu + 32) >> 6);
+		dst[4*i+3] = 255;
+	}
+
+	return w;
+}
+
+
+#if defined(__SSE2__)
+/* 8 pixels per iteration in 16 bits lanes. The sums of B can exceed the
+ * lane range only for values that saturate to 255 anyway, so they are
+ * done with saturation.
+ */
+static
+unsigned int yuv_row_sse2(uint8_t* restrict dst, const uint8_t* y,
+                          const uint8_t* u, const uint8_t* v,
+                          unsigned int cstep, unsigned int w)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i lo16 = _mm_set1_epi32(0xFFFF);
+	const __m128i alpha = _mm_set1_epi8((char)0xFF);
+	const __m128i off = _mm_set1_epi16(16), half = _mm_set1_epi16(128);
+	const __m128i rnd = _mm_set1_epi16(32);
+	__m128i yy, uu, vv, uv, r, g, b, rg, ba;
+	unsigned int i;
+
+	for (i=0; i+8<=w; i+=8) {
+		yy = _mm_loadl_epi64((const __m128i*)(y+i));
+		yy = _mm_unpacklo_epi8(yy, zero);
+
+		// Replicate the 4 chroma samples of the 8 pixels
+		if (cstep == 1) {
+			uu = _mm_cvtsi32_si128(*(const int32_t*)(u+i/2));
+			vv = _mm_cvtsi32_si128(*(const int32_t*)(v+i/2));
+			uu = _mm_unpacklo_epi8(_mm_unpacklo_epi8(uu, uu), zero);
+			vv = _mm_unpacklo_epi8(_mm_unpacklo_epi8(vv, vv), zero);
+		} else {
+			uv = _mm_loadl_epi64((const __m128i*)(u+i));
+			uv = _mm_unpacklo_epi8(uv, zero);
+			uu = _mm_and_si128(uv, lo16);
+			vv = _mm_srli_epi32(uv, 16);
+			uu = _mm_or_si128(uu, _mm_slli_epi32(uu, 16));
+			vv = _mm_or_si128(vv, _mm_slli_epi32(vv, 16));
+		}
+
+		yy = _mm_mullo_epi16(_mm_sub_epi16(yy, off), _mm_set1_epi16(CY));
+		yy = _mm_add_epi16(yy, rnd);
+		uu = _mm_sub_epi16(uu, half);
+		vv = _mm_sub_epi16(vv, half);
+
+		r = _mm_adds_epi16(yy, _mm_mullo_epi16(vv, _mm_set1_epi16(CRV)));
+		g = _mm_sub_epi16(yy, _mm_mullo_epi16(uu, _mm_set1_epi16(CGU)));
+		g = _mm_sub_epi16(g, _mm_mullo_epi16(vv, _mm_set1_epi16(CGV)));
+		b = _mm_adds_epi16(yy, _mm_mullo_epi16(uu, _mm_set1_epi16(CBU)));
+		r = _mm_packus_epi16(_mm_srai_epi16(r, 6), zero);
+		g = _mm_packus_epi16(_mm_srai_epi16(g, 6), zero);
+		b = _mm_packus_epi16(_mm_srai_epi16(b, 6), zero);
+
+		// Interleave into RGBA pixels
+		rg = _mm_unpacklo_epi8(r, g);
+		ba = _mm_unpacklo_epi8(b, alpha);
+		_mm_storeu_si128((__m128i*)(dst+4*i),
+		                 _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(dst+4*i+16),
+		                 _mm_unpackhi_epi16(rg, ba));
+	}
+
+	return i;
+}
+#endif // __SSE2__
+
+
+/*************************************************************************
+ *                                                                       *
+ *                          Internal functions                           *
+ *                                                                       *
+ *************************************************************************/
+/* Convert a frame whose planes are laid out as described by tex into
+ * rgba, an array of tightly packed RGBA pixels
+ */
+LOCAL_FN
+void convert_yuv_frame(const struct dtk_texture* tex, const uint8_t* frame,
+                       uint8_t* rgba)
+{
+	const struct mipmapdata *luma = tex->data, *chroma = tex->planes;
+	const uint8_t *y, *u, *v;
+	unsigned int row, done, cstep, w = luma->w;
+	yuvfn kernel = yuv_row_scalar;
+
+#if defined(__SSE2__)
+	kernel = yuv_row_sse2;
+#endif
+
+	// I420 has one plane per component, NV12 interleaves U and V
+	cstep = (tex->nplanes == 2) ? 1 : 2;
+	for (row=0; row<luma->h; row++) {
+		y = frame + luma->offset + row*luma->stride;
+		u = frame + chroma[0].offset + (row/2)*chroma[0].stride;
+		v = (cstep == 1) ? frame + chroma[1].offset
+		                   + (row/2)*chroma[1].stride : u + 1;
+
+		done = kernel(rgba, y, u, v, cstep, w);
+		if (done < w)
+			yuv_row_scalar(rgba + 4*done, y + done, u + (done/2)*cstep,
+			               v + (done/2)*cstep, cstep, w - done);
+		rgba += 4*w;
+	}
+}
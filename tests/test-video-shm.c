@@ -0,0 +1,169 @@
+/*
+    Copyright (C) 2012  EPFL (Ecole Polytechnique Fédérale de Lausanne)
+    Laboratory CNBI (Chair in Non-Invasive Brain-Machine Interface)
+    Nicolas Bourdaud <nicolas.bourdaud@epfl.ch>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <dtk_video.h>
+#include <dtk_shmvideo.h>
+#include <drawtk.h>
+#include <dtk_time.h>
+#include <dtk_colors.h>
+
+#define WIDTH		320
+#define HEIGHT		240
+#define NSLOTS		3
+#define NFRAMES		100
+#define PERIOD_NS	10000000	/* 100 frames per second */
+#define MAX_LATENCY_US	100000
+
+static struct dtk_shmv_header* ring = NULL;
+static size_t ringsize;
+
+static
+int create_ring(const char* name)
+{
+	uint64_t stride = dtk_shmv_framesize(DTK_SHMV_GRAY, WIDTH, HEIGHT);
+	uint64_t offset = DTK_SHMV_ROUNDUP(sizeof(*ring)
+	                                   + NSLOTS*sizeof(ring->slots[0]), 64);
+	int fd;
+
+	ringsize = offset + NSLOTS*stride;
+	fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd < 0)
+		return -1;
+	if (ftruncate(fd, ringsize)) {
+		close(fd);
+		return -1;
+	}
+	ring = mmap(NULL, ringsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+		return -1;
+
+	ring->magic = DTK_SHMV_MAGIC;
+	ring->version = DTK_SHMV_VERSION;
+	ring->format = DTK_SHMV_GRAY;
+	ring->width = WIDTH;
+	ring->height = HEIGHT;
+	ring->nslots = NSLOTS;
+	ring->slotstride = stride;
+	ring->dataoffset = offset;
+	sem_init(&ring->newframe, 1, 0);
+	return 0;
+}
+
+
+static
+void* producer_thread(void* arg)
+{
+	struct dtk_shmv_slot* sl;
+	struct dtk_timespec ts, next;
+	uint64_t n;
+	char* data;
+	(void)arg;
+
+	dtk_gettime(&next);
+	for (n=0; n<NFRAMES; n++) {
+		sl = ring->slots + (n % NSLOTS);
+		data = (char*)ring + ring->dataoffset
+		       + (n % NSLOTS)*ring->slotstride;
+
+		__atomic_store_n(&sl->seq, 2*n+1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		memset(data, (int)(n*2), ring->slotstride);
+		dtk_gettime(&ts);
+		sl->pts = (int64_t)ts.sec*1000000000 + ts.nsec;
+		__atomic_store_n(&sl->seq, 2*n+2, __ATOMIC_RELEASE);
+		__atomic_store_n(&ring->head, n+1, __ATOMIC_RELEASE);
+		sem_post(&ring->newframe);
+
+		dtk_addtime(&next, 0, PERIOD_NS);
+		dtk_nanosleep(1, &next, NULL);
+	}
+
+	return NULL;
+}
+
+
+int main(void)
+{
+	dtk_hwnd wnd;
+	dtk_htex video;
+	dtk_hshape shape;
+	pthread_t thread;
+	struct dtk_video_stats stats;
+	struct dtk_timespec delay = {0, 5000000};
+	unsigned int w, h, i;
+	char name[64];
+	int retcode = EXIT_FAILURE;
+
+	sprintf(name, "/dtk-test-shm-%u", (unsigned int)getpid());
+	if (create_ring(name)) {
+		fprintf(stderr, "Cannot create the ring %s\n", name);
+		return EXIT_FAILURE;
+	}
+
+	wnd = dtk_create_window(640, 480, 0, 0, 16, "test-video-shm");
+	dtk_make_current_window(wnd);
+
+	video = dtk_load_video_shm(DTK_AUTOSTART, name);
+	if (!video) {
+		fprintf(stderr, "Cannot load the video from %s\n", name);
+		goto exit;
+	}
+	dtk_texture_getsize(video, &w, &h);
+	printf("video size: w=%u  h=%u\n", w, h);
+	if (w != WIDTH || h != HEIGHT
+	   || dtk_video_exec(video, DTKV_CMD_SEEK, NULL) != -1)
+		goto exit;
+
+	shape = dtk_create_image(NULL, 0.0f, 0.0f, 1.0f, 1.0f,
+	                         dtk_white, video);
+	pthread_create(&thread, NULL, producer_thread, NULL);
+	for (i=0; i<NFRAMES; i++) {
+		dtk_clear_screen(wnd);
+		dtk_draw_shape(shape);
+		dtk_update_screen(wnd);
+		dtk_nanosleep(0, &delay, NULL);
+	}
+	pthread_join(thread, NULL);
+
+	dtk_video_getstats(video, &stats);
+	printf("decoded=%lu uploaded=%lu presented=%lu latency=%ldus\n",
+	       stats.decoded, stats.uploaded, stats.presented,
+	       stats.latency_us);
+	if (stats.decoded && stats.uploaded && stats.latency_us >= 0
+	    && stats.latency_us < MAX_LATENCY_US)
+		retcode = EXIT_SUCCESS;
+
+	dtk_destroy_shape(shape);
+
+exit:
+	if (video)
+		dtk_destroy_texture(video);
+	dtk_close(wnd);
+	sem_destroy(&ring->newframe);
+	munmap(ring, ringsize);
+	shm_unlink(name);
+	return retcode;
+}
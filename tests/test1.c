@@ -41,6 +41,7 @@ dtk_htex tex, tex2;
 dtk_hfont font;
 dtk_hshape tri, tri2, cir, cir2, arr, rec1, rec2, rec3, rec4, cro, img, img2, str, cshp;
 dtk_hshape comp;
+dtk_hbatch batch;
 
 #define red	dtk_red
 #define green	dtk_green
@@ -137,6 +138,16 @@ int main(int argc, char* argv[])
 	dtk_draw_shape(comp);
 	dtk_draw_shape(cshp);
 	dtk_update_screen(wnd);
+	dtk_nanosleep(0, &delay, NULL);
+
+	// Same frame drawn through a batch
+	dtk_clear_screen(wnd);
+	batch = dtk_create_batch();
+	if (dtk_batch_add(batch, comp) || dtk_batch_add(batch, cshp))
+		fprintf(stderr, "Failed to fill the batch\n");
+	dtk_batch_draw(batch);
+	dtk_destroy_batch(batch);
+	dtk_update_screen(wnd);
 
 	delay.sec = 0;
 	delay.nsec = 5000000; // 5ms